@@ -75,6 +75,13 @@
 /* FLOAT, 4 values, min, max, accel, <deprecated> */
 #define SYNAPTICS_PROP_SPEED "Synaptics Move Speed"
 
+/* 8 bit, 1 value, 0 linear, 1 piecewise, 2 sigmoid */
+#define SYNAPTICS_PROP_ACCEL_PROFILE "Synaptics Acceleration Profile"
+
+/* FLOAT, up to 2 * ACCEL_MAX_POINTS values, velocity, factor pairs of the
+ * piecewise profile, velocities increasing. 0 values for the default. */
+#define SYNAPTICS_PROP_ACCEL_POINTS "Synaptics Acceleration Points"
+
 /* 8 bit (BOOL), 2 values, updown, leftright */
 #define SYNAPTICS_PROP_BUTTONSCROLLING "Synaptics Button Scrolling"
 
@@ -121,6 +128,9 @@
 /* 8 bit (BOOL) */
 #define SYNAPTICS_PROP_PALM_DETECT "Synaptics Palm Detection"
 
+/* 8 bit (BOOL) */
+#define SYNAPTICS_PROP_ABSOLUTE_HOVER "Synaptics Absolute Hover"
+
 /* 32 bit, 2 values, width, z */
 #define SYNAPTICS_PROP_PALM_DIMENSIONS "Synaptics Palm Dimensions"
 
@@ -149,6 +159,10 @@
 /* 32 bit, 4 values, left, right, top, bottom */
 #define SYNAPTICS_PROP_AREA "Synaptics Area"
 
+/* 32 bit, 4 values, left, right, top, bottom; touches starting inside are
+ * absolute, 0 disables an edge */
+#define SYNAPTICS_PROP_ABSOLUTE_ZONE "Synaptics Absolute Zone"
+
 /* 32 bit, 4 values, left, right, top, buttom */
 #define SYNAPTICS_PROP_SOFTBUTTON_AREAS "Synaptics Soft Button Areas"
 
@@ -158,4 +172,31 @@
 /* 32 Bit Integer, 2 values, horizontal hysteresis, vertical hysteresis */
 #define SYNAPTICS_PROP_NOISE_CANCELLATION "Synaptics Noise Cancellation"
 
+/* 8 bit (BOOL), 1 value, record the raw input to the RecordFile */
+#define SYNAPTICS_PROP_RECORD "Synaptics Record"
+
+/* 32 bit, up to MAX_GESTURE values (see synapticsstr.h), 0 disables an
+ * element. 3-finger swipe left, right, up, down, 4-finger swipe left, right,
+ * up, down, pinch in, pinch out, rotate left, rotate right. Positive values
+ * are buttons, -1 to -4 scroll up, down, left, right. */
+#define SYNAPTICS_PROP_GESTURE_ACTIONS "Synaptics Gesture Actions"
+
+/* 32 bit, 3 values, swipe distance, pinch ratio in percent, rotate angle
+ * in degrees */
+#define SYNAPTICS_PROP_GESTURE_THRESHOLDS "Synaptics Gesture Thresholds"
+
+/* 32 bit, 4 values, x1, y1, x2, y2 inner control points of the pressure
+ * curve, 0-100 */
+#define SYNAPTICS_PROP_PRESSURE_CURVE "Synaptics Pressure Curve"
+
+/* 32 bit, 4 or 54 values, reachable min x, max x, min y, max y, then the
+ * x, y offsets of the 5x5 correction grid nodes, row by row */
+#define SYNAPTICS_PROP_CALIBRATION "Synaptics Calibration"
+
+/* 8 bit (BOOL), 2 values, learn extents, fit correction grid */
+#define SYNAPTICS_PROP_CALIBRATION_LEARNING "Synaptics Calibration Learning"
+
+/* 8 bit, valid values 0..2 (inclusive): low, high, adaptive */
+#define SYNAPTICS_PROP_REPORT_RATE "Synaptics Report Rate"
+
 #endif                          /* _SYNAPTICS_PROPERTIES_H_ */
@@ -85,48 +85,336 @@ ALPS_initialize(int fd)
     ALPS_sync(fd);
 }
 
+/*
+ * Newer ALPS touchpads (v3 "Pinnacle" and later) have to be put into
+ * absolute mode through their register interface and send a different,
+ * multi-packet format with a finger bitmap for multitouch.
+ */
+enum ALPSProtocol {
+    ALPS_PROTO_LEGACY,          /* v1/v2 6-byte absolute packets */
+    ALPS_PROTO_V3,              /* v3 position and bitmap packets */
+};
+
+#define ALPS_V3_X_MAX 2000
+#define ALPS_V3_Y_MAX 1400
+#define ALPS_V3_X_BITS 15       /* Sensor lines in the bitmap */
+#define ALPS_V3_Y_BITS 11
+
+/* PS/2 commands used to send one nibble in command mode, indexed by nibble.
+ * A param of -1 means the command has none. */
+static const struct {
+    byte cmd;
+    int param;
+} alps_v3_nibble_commands[16] = {
+    {PS2_CMD_SET_REMOTE_MODE, -1},      /* 0 */
+    {PS2_CMD_DISABLE, -1},      /* 1 */
+    {PS2_CMD_SET_SCALING_2_1, -1},      /* 2 */
+    {PS2_CMD_SET_SAMPLE_RATE, 0x0a},    /* 3 */
+    {PS2_CMD_SET_SAMPLE_RATE, 0x14},    /* 4 */
+    {PS2_CMD_SET_SAMPLE_RATE, 0x28},    /* 5 */
+    {PS2_CMD_SET_SAMPLE_RATE, 0x3c},    /* 6 */
+    {PS2_CMD_SET_SAMPLE_RATE, 0x50},    /* 7 */
+    {PS2_CMD_SET_SAMPLE_RATE, 0x64},    /* 8 */
+    {PS2_CMD_SET_SAMPLE_RATE, 0xc8},    /* 9 */
+    {PS2_CMD_READ_DEVICE_TYPE, -1},     /* a, answers with one byte */
+    {PS2_CMD_SET_RESOLUTION, 0x00},     /* b */
+    {PS2_CMD_SET_RESOLUTION, 0x01},     /* c */
+    {PS2_CMD_SET_RESOLUTION, 0x02},     /* d */
+    {PS2_CMD_SET_RESOLUTION, 0x03},     /* e */
+    {PS2_CMD_SET_SCALING_1_1, -1},      /* f */
+};
+
+struct ALPSHwInfo {
+    enum ALPSProtocol proto;
+    byte e7[3];                 /* E7 report */
+    byte ec[3];                 /* EC report */
+    Bool multi_packet;          /* A position packet waits for its bitmap */
+    unsigned char multi_data[6];        /* ... and this is it */
+    Bool slot_open[2];          /* Semi-mt bounding box corners */
+    int next_id;                /* Tracking ID for the next touch */
+};
+
+/*
+ * Send init, 3x rpt and a status request, and read the 3 byte answer.
+ * init may be 0 to skip it.
+ */
+static Bool
+ALPS_report(int fd, byte init, byte rpt, byte *param)
+{
+    int i;
+
+    if (init && (!ps2_putbyte(fd, init) ||
+                 (init == PS2_CMD_SET_RESOLUTION && !ps2_putbyte(fd, 0))))
+        return FALSE;
+
+    for (i = 0; i < 3; i++)
+        if (!ps2_putbyte(fd, rpt))
+            return FALSE;
+
+    if (!ps2_putbyte(fd, PS2_CMD_STATUS_REQUEST))
+        return FALSE;
+
+    for (i = 0; i < 3; i++)
+        if (!ps2_getbyte(fd, &param[i]))
+            return FALSE;
+
+    return TRUE;
+}
+
+static struct ALPSHwInfo *
+ALPS_hw_info(InputInfoPtr pInfo)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+
+    if (!priv->proto_data)
+        priv->proto_data = calloc(1, sizeof(struct ALPSHwInfo));
+    return priv->proto_data;
+}
+
+/*
+ * Find out which protocol the touchpad speaks from its E7 and EC reports.
+ */
+static void
+ALPS_identify(InputInfoPtr pInfo, struct ALPSHwInfo *alps)
+{
+    int fd = pInfo->fd;
+
+    alps->proto = ALPS_PROTO_LEGACY;
+
+    xf86FlushInput(fd);
+    if (!ps2_putbyte(fd, PS2_CMD_DISABLE) ||
+        !ALPS_report(fd, PS2_CMD_SET_RESOLUTION, PS2_CMD_SET_SCALING_2_1,
+                     alps->e7) ||
+        !ALPS_report(fd, 0, PS2_CMD_RESET_WRAP_MODE, alps->ec)) {
+        xf86IDrvMsg(pInfo, X_WARNING,
+                    "ALPS identification failed, assuming legacy protocol\n");
+        return;
+    }
+    ps2_putbyte(fd, PS2_CMD_SET_STREAM_MODE);
+
+    xf86IDrvMsg(pInfo, X_PROBED,
+                "ALPS E7 report %02x %02x %02x, EC report %02x %02x %02x\n",
+                alps->e7[0], alps->e7[1], alps->e7[2],
+                alps->ec[0], alps->ec[1], alps->ec[2]);
+
+    if (alps->e7[0] == 0x73 && alps->e7[1] == 0x02 && alps->e7[2] == 0x64 &&
+        alps->ec[0] == 0x88 && alps->ec[1] == 0x07 &&
+        alps->ec[2] >= 0x90 && alps->ec[2] <= 0x9d) {
+        xf86IDrvMsg(pInfo, X_PROBED, "ALPS v3 protocol\n");
+        alps->proto = ALPS_PROTO_V3;
+    }
+}
+
+static Bool
+ALPS_v3_send_nibble(int fd, int nibble)
+{
+    byte dummy;
+
+    if (!ps2_putbyte(fd, alps_v3_nibble_commands[nibble].cmd))
+        return FALSE;
+    if (alps_v3_nibble_commands[nibble].param >= 0)
+        return ps2_putbyte(fd, alps_v3_nibble_commands[nibble].param);
+    if (alps_v3_nibble_commands[nibble].cmd == PS2_CMD_READ_DEVICE_TYPE)
+        return ps2_getbyte(fd, &dummy);
+    return TRUE;
+}
+
+static Bool
+ALPS_v3_set_addr(int fd, int addr)
+{
+    int i;
+
+    if (!ps2_putbyte(fd, PS2_CMD_RESET_WRAP_MODE))
+        return FALSE;
+
+    for (i = 12; i >= 0; i -= 4)
+        if (!ALPS_v3_send_nibble(fd, (addr >> i) & 0xf))
+            return FALSE;
+
+    return TRUE;
+}
+
+/* Returns the register value, or -1 on error */
+static int
+ALPS_v3_read_reg(int fd, int addr)
+{
+    byte param[3];
+    int i;
+
+    if (!ALPS_v3_set_addr(fd, addr) ||
+        !ps2_putbyte(fd, PS2_CMD_STATUS_REQUEST))
+        return -1;
+
+    for (i = 0; i < 3; i++)
+        if (!ps2_getbyte(fd, &param[i]))
+            return -1;
+
+    /* The touchpad echoes the address */
+    if (((param[0] << 8) | param[1]) != addr)
+        return -1;
+
+    return param[2];
+}
+
+/* Write to the register last read from */
+static Bool
+ALPS_v3_write_reg(int fd, int value)
+{
+    return ALPS_v3_send_nibble(fd, (value >> 4) & 0xf) &&
+        ALPS_v3_send_nibble(fd, value & 0xf);
+}
+
+static Bool
+ALPS_v3_initialize(int fd)
+{
+    byte param[3];
+    int reg;
+
+    xf86FlushInput(fd);
+    if (!ps2_putbyte(fd, PS2_CMD_DISABLE))
+        return FALSE;
+
+    /* Enter command mode */
+    if (!ALPS_report(fd, 0, PS2_CMD_RESET_WRAP_MODE, param) ||
+        param[0] != 0x88 || (param[1] != 0x07 && param[1] != 0x08))
+        return FALSE;
+
+    /* Absolute mode */
+    reg = ALPS_v3_read_reg(fd, 0x0004);
+    if (reg < 0 || !ALPS_v3_write_reg(fd, reg | 0x06))
+        return FALSE;
+
+    /* Leave command mode, set the rate and start reporting */
+    return ps2_putbyte(fd, PS2_CMD_SET_STREAM_MODE) &&
+        ps2_putbyte(fd, PS2_CMD_SET_SAMPLE_RATE) &&
+        ps2_putbyte(fd, 0x64) && ps2_putbyte(fd, PS2_CMD_ENABLE);
+}
+
 static Bool
 ALPSQueryHardware(InputInfoPtr pInfo)
 {
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+    struct ALPSHwInfo *alps = ALPS_hw_info(pInfo);
+
+    if (!alps)
+        return FALSE;
+
+    alps->multi_packet = FALSE;
+    priv->comm.ringHead = priv->comm.ringTail;
+
+    if (alps->proto == ALPS_PROTO_V3) {
+        if (ALPS_v3_initialize(pInfo->fd))
+            return TRUE;
+        xf86IDrvMsg(pInfo, X_WARNING,
+                    "ALPS v3 initialization failed, using legacy mode\n");
+        alps->proto = ALPS_PROTO_LEGACY;
+    }
+
     ALPS_initialize(pInfo->fd);
     return TRUE;
 }
 
-static Bool
-ALPS_packet_ok(struct CommData *comm)
+static void
+ALPSReadDevDimensions(InputInfoPtr pInfo)
 {
-    /* ALPS absolute mode packets start with 0b11111mrl */
-    if ((comm->protoBuf[0] & 0xf8) == 0xf8)
-        return TRUE;
-    return FALSE;
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+    struct ALPSHwInfo *alps = ALPS_hw_info(pInfo);
+
+    if (!alps)
+        return;
+
+    ALPS_identify(pInfo, alps);
+    if (alps->proto != ALPS_PROTO_V3)
+        return;
+
+    priv->minx = 0;
+    priv->maxx = ALPS_V3_X_MAX;
+    priv->miny = 0;
+    priv->maxy = ALPS_V3_Y_MAX;
+    priv->minp = 0;
+    priv->maxp = 127;
+
+    /* The bitmap gives the bounding box of the fingers */
+    priv->has_touch = TRUE;
+    priv->has_semi_mt = TRUE;
+    priv->max_touches = 2;
+    priv->num_mt_axes = 0;
 }
 
+/*
+ * Is there a valid packet at the head of the ring? Returns its length,
+ * 0 if more bytes are needed, or -1 if the head byte can't start a packet.
+ */
+static int
+ALPS_packet_ok(const struct ALPSHwInfo *alps, struct CommData *comm)
+{
+    unsigned int avail = comm->ringTail - comm->ringHead;
+    unsigned char b0 = COMM_RING_BYTE(comm, comm->ringHead);
+    int len, i;
+
+    if (alps->proto == ALPS_PROTO_V3) {
+        /* v3 packets start with 0b1?xx1111 */
+        if ((b0 & 0x8f) != 0x8f)
+            return -1;
+        len = 6;
+    }
+    else if ((b0 & 0xc8) == 0x08)       /* PS/2 packet from the stick */
+        return avail >= 3 ? 3 : 0;
+    else if ((b0 & 0xf8) == 0xf8)       /* 0b11111mrl */
+        len = 6;
+    else
+        return -1;
+
+    if (avail < len)
+        return 0;
+
+    /* All but the first byte have the top bit clear */
+    for (i = 1; i < len; i++)
+        if (COMM_RING_BYTE(comm, comm->ringHead + i) & 0x80)
+            return -1;
+
+    return len;
+}
+
+/*
+ * Frame the next packet into comm->protoBuf. Garbage is skipped up to the
+ * next byte that starts a valid packet, the rest of the input is kept.
+ */
 static Bool
-ALPS_get_packet(struct CommData *comm, InputInfoPtr pInfo)
+ALPS_get_packet(const struct ALPSHwInfo *alps, struct CommData *comm,
+                InputInfoPtr pInfo)
 {
-    int c;
+    int c, len = 0, i;
 
-    while ((c = XisbRead(comm->buffer)) >= 0) {
-        unsigned char u = (unsigned char) c;
+    comm->resyncBytes = 0;
 
-        comm->protoBuf[comm->protoBufTail++] = u;
+    while (comm->ringTail - comm->ringHead < COMM_RING_SIZE &&
+           (c = SynapticsCommRead(comm)) >= 0)
+        COMM_RING_BYTE(comm, comm->ringTail++) = (unsigned char) c;
 
-        if (comm->protoBufTail == 3) {  /* PS/2 packet received? */
-            if ((comm->protoBuf[0] & 0xc8) == 0x08) {
-                comm->protoBufTail = 0;
-                return TRUE;
-            }
+    while (comm->ringTail != comm->ringHead) {
+        len = ALPS_packet_ok(alps, comm);
+        if (len == 0)
+            break;
+        if (len < 0) {
+            comm->ringHead++;
+            comm->resyncBytes++;
+            continue;
         }
 
-        if (comm->protoBufTail >= 6) {  /* Full packet received */
-            comm->protoBufTail = 0;
-            if (ALPS_packet_ok(comm))
-                return TRUE;
-            while ((c = XisbRead(comm->buffer)) >= 0);  /* If packet is invalid, re-sync */
-        }
+        for (i = 0; i < len; i++)
+            comm->protoBuf[i] = COMM_RING_BYTE(comm, comm->ringHead + i);
+        comm->ringHead += len;
+        comm->protoBufTail = len;
+        break;
     }
 
-    return FALSE;
+    if (comm->resyncBytes > 0)
+        LogMessageVerbSigSafe(X_INFO, 7,
+                              "ALPS driver dropped %d bytes to resync\n",
+                              comm->resyncBytes);
+
+    return len > 0;
 }
 
 /*
@@ -153,7 +441,7 @@ ALPS_process_packet(unsigned char *packet, struct SynapticsHwState *hw)
     int left = 0, right = 0, middle = 0;
     int i;
 
-    hw->millis = GetTimeInMillis();
+    SynapticsSetHwTime(hw, SynapticsGetTimeInMicros());
 
     x = (packet[1] & 0x7f) | ((packet[2] & 0x78) << (7 - 3));
     y = (packet[4] & 0x7f) | ((packet[3] & 0x70) << (7 - 4));
@@ -206,20 +494,195 @@ ALPS_process_packet(unsigned char *packet, struct SynapticsHwState *hw)
     hw->middle = middle;
 }
 
+static int
+ALPS_fls(unsigned int map)
+{
+    int n = 0;
+
+    while (map) {
+        map >>= 1;
+        n++;
+    }
+    return n;
+}
+
+/*
+ * Turn the bits set in a sensor line bitmap into the centre of the lowest
+ * and the highest run of set lines, scaled to 0 - max.
+ */
+static void
+ALPS_bitmap_range(unsigned int map, int bits, int max, int *lo, int *hi)
+{
+    int start, end;
+
+    start = ffs(map) - 1;
+    for (end = start; map & (1U << (end + 1)); end++);
+    *lo = max * (start + end) / (2 * (bits - 1));
+
+    end = ALPS_fls(map) - 1;
+    for (start = end; start > 0 && map & (1U << (start - 1)); start--);
+    *hi = max * (start + end) / (2 * (bits - 1));
+}
+
+static void
+ALPS_set_slot(struct ALPSHwInfo *alps, struct SynapticsHwState *hw,
+              int slot, Bool down, int x, int y)
+{
+    if (slot >= hw->num_mt_mask)
+        return;
+
+    if (down) {
+        if (!alps->slot_open[slot]) {
+            hw->slot_state[slot] = SLOTSTATE_OPEN;
+            hw->num_opened++;
+            hw->touch_id[slot] = alps->next_id++ & 0xffff;
+        }
+        else
+            hw->slot_state[slot] = SLOTSTATE_UPDATE;
+        valuator_mask_set(hw->mt_mask[slot], 0, x);
+        valuator_mask_set(hw->mt_mask[slot], 1, y);
+        hw->touch_x[slot] = x;
+        hw->touch_y[slot] = y;
+    }
+    else if (alps->slot_open[slot])
+        hw->slot_state[slot] = SLOTSTATE_CLOSE;
+
+    alps->slot_open[slot] = down;
+}
+
+/*
+ * ALPS v3 position packet
+ * byte 0: 1 mp x1 x0 1 1 1 1       (mp: this is a bitmap packet)
+ * byte 1: 0 x10 x9 x8 x7 x6 x5 x4
+ * byte 2: 0 y10 y9 y8 y7 y6 y5 y4
+ * byte 3: 0 tmid trig tlef 1 mid rig lef       (t: trackstick buttons)
+ * byte 4: 0 fmp x3 x2 y3 y2 y1 y0              (fmp: a bitmap follows)
+ * byte 5: 0 z6 z5 z4 z3 z2 z1 z0
+ *
+ * ALPS v3 bitmap packet
+ * byte 0: 1 1 x1 x0 1 1 1 1
+ * byte 1: 0 x8 x7 x6 x5 x4 x3 x2
+ * byte 2: 0 y7 y6 y5 y4 y3 y2 y1
+ * byte 3: 0 y10 y9 y8 1 1 1 1
+ * byte 4: 0 x14 x13 x12 x11 x10 x9 y0
+ * byte 5: 0 0 ? ? ? ? f1 f0               (number of fingers - 1)
+ *
+ * Packets with 0x3f in byte 5 come from the trackstick.
+ *
+ * Returns TRUE if hw was updated.
+ */
+static Bool
+ALPS_process_packet_v3(struct ALPSHwInfo *alps, unsigned char *packet,
+                       struct SynapticsHwState *hw)
+{
+    unsigned char *pos = packet;
+    unsigned int x_map = 0, y_map = 0;
+    int fingers = 0;
+    int x, y, z, i;
+
+    if (packet[5] == 0x3f) {    /* trackstick, only buttons are used */
+        hw->left = packet[3] & 1;
+        hw->right = (packet[3] >> 1) & 1;
+        hw->middle = (packet[3] >> 2) & 1;
+        SynapticsSetHwTime(hw, SynapticsGetTimeInMicros());
+        return TRUE;
+    }
+
+    if (alps->multi_packet) {
+        alps->multi_packet = FALSE;
+        if (packet[0] & 0x40) {
+            fingers = (packet[5] & 0x3) + 1;
+            x_map = ((packet[4] & 0x7e) << 8) |
+                ((packet[1] & 0x7f) << 2) | ((packet[0] & 0x30) >> 4);
+            y_map = ((packet[3] & 0x70) << 4) |
+                ((packet[2] & 0x7f) << 1) | (packet[4] & 0x01);
+            pos = alps->multi_data;
+        }
+    }
+
+    /* A lone bitmap packet, the position packet got lost */
+    if (pos == packet && (packet[0] & 0x40))
+        return FALSE;
+
+    /* The bitmap follows in the next packet */
+    if (pos == packet && (packet[4] & 0x40)) {
+        alps->multi_packet = TRUE;
+        memcpy(alps->multi_data, packet, sizeof(alps->multi_data));
+        return FALSE;
+    }
+
+    x = ((pos[1] & 0x7f) << 4) | ((pos[4] & 0x30) >> 2) |
+        ((pos[0] & 0x30) >> 4);
+    y = ((pos[2] & 0x7f) << 4) | (pos[4] & 0x0f);
+    z = pos[5] & 0x7f;
+
+    /* Single packets with z = 0 in the middle of a stream are flukes, a
+     * real release has x, y and z all zero. */
+    if (x && y && !z)
+        return FALSE;
+
+    SynapticsSetHwTime(hw, SynapticsGetTimeInMicros());
+    hw->x = x;
+    hw->y = y;
+    hw->z = z;
+    hw->fingerWidth = 5;
+    hw->up = hw->down = FALSE;
+    for (i = 0; i < 8; i++)
+        hw->multi[i] = FALSE;
+
+    /* On a dualpoint, 'or' the trackstick buttons in */
+    hw->left = (pos[3] & 0x11) ? 1 : 0;
+    hw->right = (pos[3] & 0x22) ? 1 : 0;
+    hw->middle = (pos[3] & 0x44) ? 1 : 0;
+
+    if (fingers >= 2 && ALPS_fls(x_map) <= ALPS_V3_X_BITS &&
+        ALPS_fls(y_map) <= ALPS_V3_Y_BITS && x_map && y_map) {
+        int x1, x2, y1, y2;
+
+        ALPS_bitmap_range(x_map, ALPS_V3_X_BITS, ALPS_V3_X_MAX, &x1, &x2);
+        ALPS_bitmap_range(y_map, ALPS_V3_Y_BITS, ALPS_V3_Y_MAX, &y1, &y2);
+        ALPS_set_slot(alps, hw, 0, TRUE, x1, y1);
+        ALPS_set_slot(alps, hw, 1, TRUE, x2, y2);
+        hw->numFingers = fingers;
+    }
+    else {
+        ALPS_set_slot(alps, hw, 0, z > 0, x, y);
+        ALPS_set_slot(alps, hw, 1, FALSE, 0, 0);
+        hw->numFingers = (z > 0) ? 1 : 0;
+    }
+
+    return TRUE;
+}
+
 static Bool
 ALPSReadHwState(InputInfoPtr pInfo,
                 struct CommData *comm, struct SynapticsHwState *hwRet)
 {
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+    struct ALPSHwInfo *alps = priv->proto_data;
     unsigned char *buf = comm->protoBuf;
     struct SynapticsHwState *hw = comm->hwState;
 
-    if (!ALPS_get_packet(comm, pInfo))
+    if (!alps) {
+        LogMessageVerbSigSafe(X_ERROR, 0,
+                              "ALPSReadHwState, proto_data is NULL. This is a bug.\n");
         return FALSE;
+    }
 
-    ALPS_process_packet(buf, hw);
+    while (ALPS_get_packet(alps, comm, pInfo)) {
+        if (alps->proto == ALPS_PROTO_V3) {
+            SynapticsResetTouchHwState(hw, FALSE);
+            if (!ALPS_process_packet_v3(alps, buf, hw))
+                continue;
+        }
+        else
+            ALPS_process_packet(buf, hw);
 
-    SynapticsCopyHwState(hwRet, hw);
-    return TRUE;
+        SynapticsCopyHwState(hwRet, hw);
+        return TRUE;
+    }
+
+    return FALSE;
 }
 
 struct SynapticsProtocolOperations alps_proto_operations = {
@@ -228,5 +691,7 @@ struct SynapticsProtocolOperations alps_proto_operations = {
     ALPSQueryHardware,
     ALPSReadHwState,
     NULL,
-    NULL
+    ALPSReadDevDimensions,
+    NULL,
+    FALSE
 };
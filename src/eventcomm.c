@@ -35,11 +35,14 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
 #include <fcntl.h>
 #include <dirent.h>
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
+#include <limits.h>
+#include <unistd.h>
 #include "synproto.h"
 #include "synapticsstr.h"
 #include <xf86.h>
@@ -70,6 +73,9 @@
 #define ABS_MT_MAX ABS_MT_TOOL_Y
 #define ABS_MT_CNT (ABS_MT_MAX - ABS_MT_MIN + 1)
 
+/* Shortest frame interval at the low report rate, 40 frames/s */
+#define LOW_RATE_INTERVAL 25000
+
 /**
  * Protocol-specific data.
  */
@@ -88,9 +94,24 @@ struct eventcomm_proto_data {
     int num_touches;
 
     struct libevdev *evdev;
-    enum libevdev_read_flag read_flag;
 
     int have_monotonic_clock;
+
+    /* Recovery from SYN_DROPPED */
+    Bool need_resync;           /* Rebuild the state before the next frame */
+    uint32_t pending_open;      /* Slots to reopen in the frame after that */
+    struct {
+        unsigned int drops;     /* SYN_DROPPED recovered from */
+        unsigned int opened;    /* Touches begun by a recovery */
+        unsigned int closed;    /* Touches ended by a recovery */
+    } resync_stats;
+
+    /* Low report rate by dropping frames */
+    Bool decimate;              /* Run at the low report rate */
+    Bool frame_held;            /* The last frame was dropped, the next one
+                                   carries its changes on */
+    CARD64 last_frame_usec;     /* Time of the last frame passed on */
+    int last_frame_buttons;     /* Buttons and fingers of that frame */
 };
 
 #ifdef HAVE_LIBEVDEV_DEVICE_LOG_FUNCS
@@ -154,8 +175,6 @@ EventProtoDataAlloc(int fd)
         goto out;
     }
 
-    proto_data->read_flag = LIBEVDEV_READ_FLAG_NORMAL;
-
 out:
     if (rc < 0) {
         if (proto_data && proto_data->evdev)
@@ -267,6 +286,8 @@ EventDeviceOnHook(InputInfoPtr pInfo, SynapticsParameters * para)
     }
 
     proto_data->need_grab = FALSE;
+    proto_data->decimate = FALSE;
+    proto_data->frame_held = FALSE;
 
     ret = libevdev_set_clock_id(proto_data->evdev, CLOCK_MONOTONIC);
     proto_data->have_monotonic_clock = (ret == 0);
@@ -282,6 +303,16 @@ EventDeviceOffHook(InputInfoPtr pInfo)
     SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
     struct eventcomm_proto_data *proto_data = priv->proto_data;
 
+    if (proto_data->resync_stats.drops)
+        xf86IDrvMsg(pInfo, X_INFO,
+                    "recovered from dropped events %u times, "
+                    "%u touches begun, %u ended\n",
+                    proto_data->resync_stats.drops,
+                    proto_data->resync_stats.opened,
+                    proto_data->resync_stats.closed);
+    proto_data->need_resync = FALSE;
+    proto_data->pending_open = 0;
+
     UninitializeTouch(pInfo);
     libevdev_grab(proto_data->evdev, LIBEVDEV_UNGRAB);
     libevdev_set_log_function(NULL, NULL);
@@ -452,6 +483,9 @@ event_query_axis_ranges(InputInfoPtr pInfo)
 
     priv->has_pressure = libevdev_has_event_code(proto_data->evdev, EV_ABS, ABS_PRESSURE);
     priv->has_width = libevdev_has_event_code(proto_data->evdev, EV_ABS, ABS_TOOL_WIDTH);
+    priv->has_distance =
+        libevdev_has_event_code(proto_data->evdev, EV_ABS, ABS_DISTANCE) ||
+        libevdev_has_event_code(proto_data->evdev, EV_ABS, ABS_MT_DISTANCE);
 
     if (priv->has_pressure)
         event_get_abs(proto_data->evdev, ABS_PRESSURE, &priv->minp, &priv->maxp,
@@ -552,25 +586,42 @@ SynapticsReadEvent(InputInfoPtr pInfo, struct input_event *ev)
     int rc;
     static struct timeval last_event_time;
 
-    rc = libevdev_next_event(proto_data->evdev, proto_data->read_flag, ev);
+    if (priv->comm.replay) {
+        int type, code, value;
+
+        if (SynapticsReplayEvent(priv->comm.replay, &ev->time,
+                                 &type, &code, &value)) {
+            ev->type = type;
+            ev->code = code;
+            ev->value = value;
+            return TRUE;
+        }
+
+        /* The device input is dropped while a log is replayed */
+        while (libevdev_next_event(proto_data->evdev,
+                                   LIBEVDEV_READ_FLAG_NORMAL, ev) >= 0);
+        return FALSE;
+    }
+
+    rc = libevdev_next_event(proto_data->evdev, LIBEVDEV_READ_FLAG_NORMAL, ev);
     if (rc < 0) {
         if (rc != -EAGAIN) {
             LogMessageVerbSigSafe(X_ERROR, 0, "%s: Read error %d\n", pInfo->name,
                     errno);
-        } else if (proto_data->read_flag == LIBEVDEV_READ_FLAG_SYNC) {
-            proto_data->read_flag = LIBEVDEV_READ_FLAG_NORMAL;
-            return SynapticsReadEvent(pInfo, ev);
         }
 
         return FALSE;
     }
 
-    /* SYN_DROPPED received in normal mode. Create a normal EV_SYN
-       so we process what's in the queue atm, then ensure we sync
-       next time */
-    if (rc == LIBEVDEV_READ_STATUS_SYNC &&
-        proto_data->read_flag == LIBEVDEV_READ_FLAG_NORMAL) {
-        proto_data->read_flag = LIBEVDEV_READ_FLAG_SYNC;
+    if (priv->comm.recorder)
+        SynapticsRecordEvent(priv->comm.recorder, &ev->time,
+                             ev->type, ev->code, ev->value);
+
+    /* SYN_DROPPED received. Create a normal EV_SYN so we process what's
+       in the queue atm, then rebuild the state from the device before
+       the next frame */
+    if (rc == LIBEVDEV_READ_STATUS_SYNC) {
+        proto_data->need_resync = TRUE;
         ev->type = EV_SYN;
         ev->code = SYN_REPORT;
         ev->value = 0;
@@ -584,13 +635,19 @@ SynapticsReadEvent(InputInfoPtr pInfo, struct input_event *ev)
 static Bool
 EventTouchSlotPreviouslyOpen(SynapticsPrivate * priv, int slot)
 {
-    int i;
+    return priv->slot_index[slot] != -1;
+}
 
-    for (i = 0; i < priv->num_active_touches; i++)
-        if (priv->open_slots[i] == slot)
-            return TRUE;
+/* Last value of an MT axis in a slot, as read from the event stream */
+static int
+event_last_mt_value(const struct eventcomm_proto_data *proto_data, int slot,
+                    int code)
+{
+    int map = proto_data->axis_map[code - ABS_MT_TOUCH_MAJOR];
 
-    return FALSE;
+    if (map < 0 || !valuator_mask_isset(proto_data->last_mt_vals[slot], map))
+        return 0;
+    return valuator_mask_get(proto_data->last_mt_vals[slot], map);
 }
 
 static void
@@ -617,9 +674,24 @@ EventProcessTouchEvent(InputInfoPtr pInfo, struct SynapticsHwState *hw,
         if (ev->code == ABS_MT_TRACKING_ID) {
             if (ev->value >= 0) {
                 hw->slot_state[slot_index] = SLOTSTATE_OPEN;
+                hw->num_opened++;
+                hw->touch_id[slot_index] = ev->value;
                 proto_data->num_touches++;
                 valuator_mask_copy(hw->mt_mask[slot_index],
                                    proto_data->last_mt_vals[slot_index]);
+                hw->touch_x[slot_index] =
+                    valuator_mask_get(hw->mt_mask[slot_index], 0);
+                hw->touch_y[slot_index] =
+                    valuator_mask_get(hw->mt_mask[slot_index], 1);
+                hw->touch_major[slot_index] =
+                    event_last_mt_value(proto_data, slot_index,
+                                        ABS_MT_TOUCH_MAJOR);
+                hw->touch_minor[slot_index] =
+                    event_last_mt_value(proto_data, slot_index,
+                                        ABS_MT_TOUCH_MINOR);
+                hw->touch_pressure[slot_index] =
+                    event_last_mt_value(proto_data, slot_index,
+                                        ABS_MT_PRESSURE);
             }
             else if (hw->slot_state[slot_index] != SLOTSTATE_EMPTY) {
                 hw->slot_state[slot_index] = SLOTSTATE_CLOSE;
@@ -637,20 +709,34 @@ EventProcessTouchEvent(InputInfoPtr pInfo, struct SynapticsHwState *hw,
         else {
             ValuatorMask *mask = proto_data->last_mt_vals[slot_index];
             int map = proto_data->axis_map[ev->code - ABS_MT_TOUCH_MAJOR];
-            int last_val = valuator_mask_get(mask, map);
 
             valuator_mask_set(hw->mt_mask[slot_index], map, ev->value);
+            switch (ev->code) {
+            case ABS_MT_POSITION_X:
+                hw->touch_x[slot_index] = ev->value;
+                break;
+            case ABS_MT_POSITION_Y:
+                hw->touch_y[slot_index] = ev->value;
+                break;
+            case ABS_MT_TOUCH_MAJOR:
+                hw->touch_major[slot_index] = ev->value;
+                break;
+            case ABS_MT_TOUCH_MINOR:
+                hw->touch_minor[slot_index] = ev->value;
+                break;
+            case ABS_MT_PRESSURE:
+                hw->touch_pressure[slot_index] = ev->value;
+                break;
+            }
             if (EventTouchSlotPreviouslyOpen(priv, slot_index)) {
-                if (ev->code == ABS_MT_POSITION_X)
-                    hw->cumulative_dx += ev->value - last_val;
-                else if (ev->code == ABS_MT_POSITION_Y)
-                    hw->cumulative_dy += ev->value - last_val;
-                else if (ev->code == ABS_MT_TOUCH_MAJOR &&
+                if (ev->code == ABS_MT_TOUCH_MAJOR &&
                          priv->has_mt_palm_detect)
                     hw->fingerWidth = ev->value;
                 else if (ev->code == ABS_MT_PRESSURE &&
                          priv->has_mt_palm_detect)
                     hw->z = ev->value;
+                else if (ev->code == ABS_MT_DISTANCE)
+                    hw->distance = ev->value;
             }
 
             valuator_mask_set(mask, map, ev->value);
@@ -693,6 +779,192 @@ apply_st_scaling(struct eventcomm_proto_data *proto_data, int value, int axis)
         proto_data->st_to_mt_offset[axis];
 }
 
+/* Fill a touch of the hardware state from the values last seen for it */
+static void
+event_fill_slot(InputInfoPtr pInfo, struct SynapticsHwState *hw, int slot,
+                enum SynapticsSlotState state)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+    struct eventcomm_proto_data *proto_data = priv->proto_data;
+    struct libevdev *evdev = proto_data->evdev;
+
+    hw->slot_state[slot] = state;
+    if (state == SLOTSTATE_OPEN)
+        hw->num_opened++;
+    hw->touch_id[slot] =
+        libevdev_get_slot_value(evdev, slot, ABS_MT_TRACKING_ID);
+    valuator_mask_copy(hw->mt_mask[slot], proto_data->last_mt_vals[slot]);
+    hw->touch_x[slot] = valuator_mask_get(hw->mt_mask[slot], 0);
+    hw->touch_y[slot] = valuator_mask_get(hw->mt_mask[slot], 1);
+    hw->touch_major[slot] =
+        event_last_mt_value(proto_data, slot, ABS_MT_TOUCH_MAJOR);
+    hw->touch_minor[slot] =
+        event_last_mt_value(proto_data, slot, ABS_MT_TOUCH_MINOR);
+    hw->touch_pressure[slot] =
+        event_last_mt_value(proto_data, slot, ABS_MT_PRESSURE);
+}
+
+/*
+ * Rebuild the hardware state after the kernel dropped events. libevdev
+ * re-reads the complete device state, which we take over as a whole. The
+ * difference between its slots and the touches the driver has open becomes
+ * the begin and end transitions the lost events would have caused. A slot
+ * that got a new touch while events were lost is ended in this frame and
+ * begun again in the next.
+ */
+static void
+event_resync(InputInfoPtr pInfo, struct CommData *comm,
+             struct SynapticsHwState *hw)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+    SynapticsParameters *para = &priv->synpara;
+    struct eventcomm_proto_data *proto_data = priv->proto_data;
+    struct libevdev *evdev = proto_data->evdev;
+    struct input_event ev;
+    int slot, axis, i;
+
+    proto_data->need_resync = FALSE;
+    proto_data->resync_stats.drops++;
+
+    /* libevdev syncs its state on the first read in sync mode; we only
+     * want the resulting state, not the events */
+    while (libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_SYNC, &ev) ==
+           LIBEVDEV_READ_STATUS_SYNC)
+        ;
+
+    hw->left = libevdev_get_event_value(evdev, EV_KEY, BTN_LEFT);
+    hw->right = libevdev_get_event_value(evdev, EV_KEY, BTN_RIGHT);
+    hw->middle = libevdev_get_event_value(evdev, EV_KEY, BTN_MIDDLE);
+    hw->up = libevdev_get_event_value(evdev, EV_KEY, BTN_FORWARD);
+    hw->down = libevdev_get_event_value(evdev, EV_KEY, BTN_BACK);
+    for (i = 0; i < 8; i++)
+        hw->multi[i] = libevdev_get_event_value(evdev, EV_KEY, BTN_0 + i);
+    comm->oneFinger = libevdev_get_event_value(evdev, EV_KEY, BTN_TOOL_FINGER);
+    comm->twoFingers =
+        libevdev_get_event_value(evdev, EV_KEY, BTN_TOOL_DOUBLETAP);
+    comm->threeFingers =
+        libevdev_get_event_value(evdev, EV_KEY, BTN_TOOL_TRIPLETAP);
+
+    hw->x = apply_st_scaling(proto_data,
+                             libevdev_get_event_value(evdev, EV_ABS, ABS_X), 0);
+    hw->y = apply_st_scaling(proto_data,
+                             libevdev_get_event_value(evdev, EV_ABS, ABS_Y), 1);
+    if (priv->has_pressure)
+        hw->z = libevdev_get_event_value(evdev, EV_ABS, ABS_PRESSURE);
+    else
+        hw->z = libevdev_get_event_value(evdev, EV_KEY, BTN_TOUCH) ?
+            para->finger_high + 1 : 0;
+    if (priv->has_width)
+        hw->fingerWidth = libevdev_get_event_value(evdev, EV_ABS,
+                                                   ABS_TOOL_WIDTH);
+    hw->distance = libevdev_get_event_value(evdev, EV_ABS, ABS_DISTANCE);
+
+    if (!priv->has_touch || !proto_data->last_mt_vals)
+        return;
+
+    proto_data->num_touches = 0;
+    proto_data->pending_open = 0;
+    proto_data->cur_slot = libevdev_get_current_slot(evdev);
+
+    for (slot = 0; slot < hw->num_mt_mask; slot++) {
+        int id = libevdev_get_slot_value(evdev, slot, ABS_MT_TRACKING_ID);
+        Bool was_open = EventTouchSlotPreviouslyOpen(priv, slot);
+
+        for (axis = ABS_MT_TOUCH_MAJOR; axis <= ABS_MT_MAX; axis++) {
+            int map = proto_data->axis_map[axis - ABS_MT_TOUCH_MAJOR];
+
+            if (map >= 0)
+                valuator_mask_set(proto_data->last_mt_vals[slot], map,
+                                  libevdev_get_slot_value(evdev, slot, axis));
+        }
+
+        if (id >= 0)
+            proto_data->num_touches++;
+
+        if (id >= 0 && !was_open) {
+            event_fill_slot(pInfo, hw, slot, SLOTSTATE_OPEN);
+            proto_data->resync_stats.opened++;
+        }
+        else if (id >= 0 && hw->touch_id[slot] == id)
+            event_fill_slot(pInfo, hw, slot, SLOTSTATE_UPDATE);
+        else if (was_open) {
+            hw->slot_state[slot] = SLOTSTATE_CLOSE;
+            proto_data->resync_stats.closed++;
+            if (id >= 0 && slot < sizeof(proto_data->pending_open) * 8)
+                proto_data->pending_open |= (1U << slot);
+        }
+    }
+
+    if (proto_data->num_touches == 0) {
+        hw->fingerWidth = 0;
+        hw->z = 0;
+    }
+
+    LogMessageVerbSigSafe(X_INFO, 3,
+                          "%s: recovered from dropped events (%u so far)\n",
+                          pInfo->name, proto_data->resync_stats.drops);
+}
+
+/* Begin the touches that replaced others while events were dropped */
+static void
+event_resync_reopen(InputInfoPtr pInfo, struct SynapticsHwState *hw)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+    struct eventcomm_proto_data *proto_data = priv->proto_data;
+    int slot;
+
+    for (slot = 0; slot < hw->num_mt_mask; slot++) {
+        if (proto_data->pending_open & (1U << slot)) {
+            event_fill_slot(pInfo, hw, slot, SLOTSTATE_OPEN);
+            proto_data->resync_stats.opened++;
+        }
+    }
+    proto_data->pending_open = 0;
+}
+
+/*
+ * Buttons and finger count of a frame, a frame that changes them is never
+ * dropped.
+ */
+static int
+event_frame_buttons(const struct SynapticsHwState *hw)
+{
+    int buttons = (hw->left ? 0x01 : 0) | (hw->middle ? 0x02 : 0) |
+        (hw->right ? 0x04 : 0) | (hw->up ? 0x08 : 0) |
+        (hw->down ? 0x10 : 0);
+    int i;
+
+    for (i = 0; i < 8; i++)
+        if (hw->multi[i])
+            buttons |= 0x20 << i;
+
+    return buttons | (hw->numFingers << 16);
+}
+
+/*
+ * At the low report rate, drop a frame that follows the last one too
+ * closely and only moves the fingers. Touches that begin or end are always
+ * passed on.
+ */
+static Bool
+event_drop_frame(struct eventcomm_proto_data *proto_data,
+                 const struct SynapticsHwState *hw)
+{
+    int i;
+
+    if (!proto_data->decimate ||
+        hw->usec - proto_data->last_frame_usec >= LOW_RATE_INTERVAL ||
+        event_frame_buttons(hw) != proto_data->last_frame_buttons)
+        return FALSE;
+
+    for (i = 0; i < hw->num_mt_mask; i++)
+        if (hw->slot_state[i] == SLOTSTATE_OPEN ||
+            hw->slot_state[i] == SLOTSTATE_CLOSE)
+            return FALSE;
+
+    return TRUE;
+}
+
 Bool
 EventReadHwState(InputInfoPtr pInfo,
                  struct CommData *comm, struct SynapticsHwState *hwRet)
@@ -703,18 +975,24 @@ EventReadHwState(InputInfoPtr pInfo,
     SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
     SynapticsParameters *para = &priv->synpara;
     struct eventcomm_proto_data *proto_data = priv->proto_data;
-    Bool sync_cumulative = FALSE;
-
-    SynapticsResetTouchHwState(hw, FALSE);
-
-    /* Reset cumulative values if buttons were not previously pressed and no
-     * two-finger scrolling is ongoing, or no finger was previously present. */
-    if (((!hw->left && !hw->right && !hw->middle) &&
-        !(priv->vert_scroll_twofinger_on || priv->vert_scroll_twofinger_on)) ||
-        hw->z < para->finger_low) {
-        hw->cumulative_dx = hw->x;
-        hw->cumulative_dy = hw->y;
-        sync_cumulative = TRUE;
+
+    if (!proto_data->frame_held)
+        SynapticsResetTouchHwState(hw, FALSE);
+    proto_data->frame_held = FALSE;
+
+    /* After dropped events, the next frames come from the device state */
+    if (proto_data->need_resync || proto_data->pending_open) {
+        if (proto_data->need_resync) {
+            event_resync(pInfo, comm, hw);
+            SynapticsResyncState(priv);
+        }
+        else
+            event_resync_reopen(pInfo, hw);
+
+        hw->numFingers = count_fingers(pInfo, comm);
+        SynapticsSetHwTime(hw, SynapticsGetTimeInMicros());
+        SynapticsCopyHwState(hwRet, hw);
+        return TRUE;
     }
 
     while (SynapticsReadEvent(pInfo, &ev)) {
@@ -724,9 +1002,17 @@ EventReadHwState(InputInfoPtr pInfo,
             case SYN_REPORT:
                 hw->numFingers = count_fingers(pInfo, comm);
                 if (proto_data->have_monotonic_clock)
-                    hw->millis = 1000 * ev.time.tv_sec + ev.time.tv_usec / 1000;
+                    SynapticsSetHwTime(hw, (CARD64) ev.time.tv_sec * 1000000 +
+                                       ev.time.tv_usec);
                 else
-                    hw->millis = GetTimeInMillis();
+                    SynapticsSetHwTime(hw, SynapticsGetTimeInMicros());
+                if (event_drop_frame(proto_data, hw)) {
+                    proto_data->frame_held = TRUE;
+                    break;
+                }
+                proto_data->frame_held = FALSE;
+                proto_data->last_frame_usec = hw->usec;
+                proto_data->last_frame_buttons = event_frame_buttons(hw);
                 SynapticsCopyHwState(hwRet, hw);
                 return TRUE;
             }
@@ -797,13 +1083,9 @@ EventReadHwState(InputInfoPtr pInfo,
                 switch (ev.code) {
                 case ABS_X:
                     hw->x = apply_st_scaling(proto_data, ev.value, 0);
-                    if (sync_cumulative)
-                        hw->cumulative_dx = hw->x;
                     break;
                 case ABS_Y:
                     hw->y = apply_st_scaling(proto_data, ev.value, 1);
-                    if (sync_cumulative)
-                        hw->cumulative_dy = hw->y;
                     break;
                 case ABS_PRESSURE:
                     hw->z = ev.value;
@@ -811,6 +1093,9 @@ EventReadHwState(InputInfoPtr pInfo,
                 case ABS_TOOL_WIDTH:
                     hw->fingerWidth = ev.value;
                     break;
+                case ABS_DISTANCE:
+                    hw->distance = ev.value;
+                    break;
                 }
             }
             else
@@ -821,6 +1106,200 @@ EventReadHwState(InputInfoPtr pInfo,
     return FALSE;
 }
 
+/*
+ * Probe cache. Querying every event node for its capabilities is slow on
+ * machines with many input devices, so the result of the probe is kept in
+ * a file, one line per node. The node is still opened, but an entry is
+ * trusted while the node has the same device number, inode, change time
+ * and device id as when it was probed, which an fstat() and a single
+ * EVIOCGID tell.
+ */
+#define PROBE_CACHE_VERSION 1
+#define PROBE_CACHE_MAX 64
+
+struct probe_cache_entry {
+    char path[64];
+    unsigned long rdev, ino;
+    long ctime;
+    int bus, vendor, product, version;
+    Bool touchpad;
+    int minx, maxx, miny, maxy;
+};
+
+struct probe_cache {
+    char *file;
+    Bool dirty;
+    int num_entries;
+    struct probe_cache_entry entries[PROBE_CACHE_MAX];
+};
+
+static struct probe_cache *
+probe_cache_load(InputInfoPtr pInfo)
+{
+    struct probe_cache *cache;
+    char *file;
+    char line[256];
+    int version;
+    FILE *f;
+
+    file = xf86CheckStrOption(pInfo->options, "ProbeCacheFile",
+                              PROBE_CACHE_FILE);
+    if (!file || !*file) {
+        free(file);
+        return NULL;
+    }
+
+    cache = calloc(1, sizeof(*cache));
+    if (!cache) {
+        free(file);
+        return NULL;
+    }
+    cache->file = file;
+
+    f = fopen(file, "r");
+    if (!f)
+        return cache;
+
+    if (!fgets(line, sizeof(line), f) ||
+        sscanf(line, "synaptics-probe %d", &version) != 1 ||
+        version != PROBE_CACHE_VERSION) {
+        fclose(f);
+        return cache;
+    }
+
+    while (cache->num_entries < PROBE_CACHE_MAX &&
+           fgets(line, sizeof(line), f)) {
+        struct probe_cache_entry *e = &cache->entries[cache->num_entries];
+        int touchpad;
+
+        if (sscanf(line, "%63s %lu %lu %ld %x %x %x %x %d %d %d %d %d",
+                   e->path, &e->rdev, &e->ino, &e->ctime, &e->bus,
+                   &e->vendor, &e->product, &e->version, &touchpad,
+                   &e->minx, &e->maxx, &e->miny, &e->maxy) != 13)
+            continue;
+        e->touchpad = !!touchpad;
+        cache->num_entries++;
+    }
+
+    fclose(f);
+    return cache;
+}
+
+static void
+probe_cache_free(InputInfoPtr pInfo, struct probe_cache *cache)
+{
+    char tmp[PATH_MAX];
+    FILE *f;
+    int i;
+
+    if (!cache)
+        return;
+
+    if (cache->dirty &&
+        snprintf(tmp, sizeof(tmp), "%s.tmp", cache->file) < (int) sizeof(tmp)) {
+        /* Write aside and rename, so a crash never leaves half a cache */
+        f = fopen(tmp, "w");
+        if (f) {
+            fprintf(f, "synaptics-probe %d\n", PROBE_CACHE_VERSION);
+            for (i = 0; i < cache->num_entries; i++) {
+                const struct probe_cache_entry *e = &cache->entries[i];
+
+                fprintf(f, "%s %lu %lu %ld %04x %04x %04x %04x %d %d %d %d %d\n",
+                        e->path, e->rdev, e->ino, e->ctime, e->bus,
+                        e->vendor, e->product, e->version, e->touchpad,
+                        e->minx, e->maxx, e->miny, e->maxy);
+            }
+            if (fclose(f) != 0 || rename(tmp, cache->file) != 0) {
+                unlink(tmp);
+                f = NULL;
+            }
+        }
+        if (!f)
+            xf86IDrvMsgVerb(pInfo, X_WARNING, 3,
+                            "failed to write probe cache %s\n", cache->file);
+    }
+
+    free(cache->file);
+    free(cache);
+}
+
+static struct probe_cache_entry *
+probe_cache_find(struct probe_cache *cache, const char *path)
+{
+    int i;
+
+    if (!cache)
+        return NULL;
+
+    for (i = 0; i < cache->num_entries; i++)
+        if (strcmp(cache->entries[i].path, path) == 0)
+            return &cache->entries[i];
+
+    return NULL;
+}
+
+/* The cached probe result for path, opened as fd, if the node did not
+ * change since */
+static struct probe_cache_entry *
+probe_cache_lookup(struct probe_cache *cache, const char *path, int fd)
+{
+    struct probe_cache_entry *e = probe_cache_find(cache, path);
+    struct input_id id;
+    struct stat st;
+    int rc;
+
+    if (!e || fstat(fd, &st) != 0)
+        return NULL;
+
+    if (e->rdev != st.st_rdev || e->ino != st.st_ino ||
+        e->ctime != st.st_ctime)
+        return NULL;
+
+    SYSCALL(rc = ioctl(fd, EVIOCGID, &id));
+    if (rc < 0 || e->bus != id.bustype || e->vendor != id.vendor ||
+        e->product != id.product || e->version != id.version)
+        return NULL;
+
+    return e;
+}
+
+static void
+probe_cache_store(struct probe_cache *cache, const char *path,
+                  struct libevdev *evdev, Bool touchpad)
+{
+    struct probe_cache_entry *e;
+    struct stat st;
+
+    if (!cache || strlen(path) >= sizeof(e->path) || stat(path, &st) != 0)
+        return;
+
+    e = probe_cache_find(cache, path);
+    if (!e) {
+        if (cache->num_entries == PROBE_CACHE_MAX)
+            return;
+        e = &cache->entries[cache->num_entries++];
+    }
+
+    memset(e, 0, sizeof(*e));
+    strcpy(e->path, path);
+    e->rdev = st.st_rdev;
+    e->ino = st.st_ino;
+    e->ctime = st.st_ctime;
+    e->bus = libevdev_get_id_bustype(evdev);
+    e->vendor = libevdev_get_id_vendor(evdev);
+    e->product = libevdev_get_id_product(evdev);
+    e->version = libevdev_get_id_version(evdev);
+    e->touchpad = touchpad;
+    if (libevdev_has_event_code(evdev, EV_ABS, ABS_X) &&
+        libevdev_has_event_code(evdev, EV_ABS, ABS_Y)) {
+        e->minx = libevdev_get_abs_minimum(evdev, ABS_X);
+        e->maxx = libevdev_get_abs_maximum(evdev, ABS_X);
+        e->miny = libevdev_get_abs_minimum(evdev, ABS_Y);
+        e->maxy = libevdev_get_abs_maximum(evdev, ABS_Y);
+    }
+    cache->dirty = TRUE;
+}
+
 /* filter for the AutoDevProbe scandir on /dev/input */
 static int
 EventDevOnly(const struct dirent *dir)
@@ -988,6 +1467,10 @@ EventAutoDevProbe(InputInfoPtr pInfo, const char *device)
     int i;
     Bool touchpad_found = FALSE;
     struct dirent **namelist;
+    struct probe_cache *cache;
+    struct probe_cache_entry *e;
+
+    cache = probe_cache_load(pInfo);
 
     if (device) {
         int fd = -1;
@@ -1001,15 +1484,23 @@ EventAutoDevProbe(InputInfoPtr pInfo, const char *device)
             int rc;
             struct libevdev *evdev;
 
-            rc = libevdev_new_from_fd(fd, &evdev);
-            if (rc >= 0) {
-                touchpad_found = event_query_is_touchpad(evdev);
-                libevdev_free(evdev);
+            e = probe_cache_lookup(cache, device, fd);
+            if (e)
+                touchpad_found = e->touchpad;
+            else {
+                rc = libevdev_new_from_fd(fd, &evdev);
+                if (rc >= 0) {
+                    touchpad_found = event_query_is_touchpad(evdev);
+                    probe_cache_store(cache, device, evdev, touchpad_found);
+                    libevdev_free(evdev);
+                }
             }
 
             if (!(pInfo->flags & XI86_SERVER_FD))
                 SYSCALL(close(fd));
 
+            probe_cache_free(pInfo, cache);
+
             /* if a device is set and not a touchpad (or already grabbed),
              * we must return FALSE.  Otherwise, we'll add a device that
              * wasn't requested for and repeat
@@ -1021,12 +1512,14 @@ EventAutoDevProbe(InputInfoPtr pInfo, const char *device)
     i = scandir(DEV_INPUT_EVENT, &namelist, EventDevOnly, alphasort);
     if (i < 0) {
         xf86IDrvMsg(pInfo, X_ERROR, "Couldn't open %s\n", DEV_INPUT_EVENT);
+        probe_cache_free(pInfo, cache);
         return FALSE;
     }
     else if (i == 0) {
         xf86IDrvMsg(pInfo, X_ERROR,
                     "The /dev/input/event* device nodes seem to be missing\n");
         free(namelist);
+        probe_cache_free(pInfo, cache);
         return FALSE;
     }
 
@@ -1039,28 +1532,40 @@ EventAutoDevProbe(InputInfoPtr pInfo, const char *device)
             struct libevdev *evdev;
 
             sprintf(fname, "%s/%s", DEV_INPUT_EVENT, namelist[i]->d_name);
+
             SYSCALL(fd = open(fname, O_RDONLY));
-            if (fd < 0)
+            if (fd < 0) {
+                free(namelist[i]);
                 continue;
+            }
 
-            rc = libevdev_new_from_fd(fd, &evdev);
-            if (rc >= 0) {
-                touchpad_found = event_query_is_touchpad(evdev);
-                libevdev_free(evdev);
-                if (touchpad_found) {
-                    xf86IDrvMsg(pInfo, X_PROBED, "auto-dev sets device to %s\n",
-                                fname);
-                    pInfo->options = xf86ReplaceStrOption(pInfo->options,
-                                                          "Device",
-                                                          fname);
+            /* Skip the capability ioctls for nodes we know already */
+            e = probe_cache_lookup(cache, fname, fd);
+            if (e)
+                touchpad_found = e->touchpad;
+            else {
+                rc = libevdev_new_from_fd(fd, &evdev);
+                if (rc >= 0) {
+                    touchpad_found = event_query_is_touchpad(evdev);
+                    probe_cache_store(cache, fname, evdev, touchpad_found);
+                    libevdev_free(evdev);
                 }
             }
             SYSCALL(close(fd));
+
+            if (touchpad_found) {
+                xf86IDrvMsg(pInfo, X_PROBED, "auto-dev sets device to %s\n",
+                            fname);
+                pInfo->options = xf86ReplaceStrOption(pInfo->options,
+                                                      "Device",
+                                                      fname);
+            }
         }
         free(namelist[i]);
     }
 
     free(namelist);
+    probe_cache_free(pInfo, cache);
 
     if (!touchpad_found) {
         xf86IDrvMsg(pInfo, X_ERROR, "no synaptics event device found\n");
@@ -1070,11 +1575,27 @@ EventAutoDevProbe(InputInfoPtr pInfo, const char *device)
     return TRUE;
 }
 
+/*
+ * The kernel has no interface for the report rate, the low rate drops
+ * frames in EventReadHwState instead.
+ */
+static Bool
+EventSetReportRate(InputInfoPtr pInfo, Bool high)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+    struct eventcomm_proto_data *proto_data = priv->proto_data;
+
+    proto_data->decimate = !high;
+    return TRUE;
+}
+
 struct SynapticsProtocolOperations event_proto_operations = {
     EventDeviceOnHook,
     EventDeviceOffHook,
     EventQueryHardware,
     EventReadHwState,
     EventAutoDevProbe,
-    EventReadDevDimensions
+    EventReadDevDimensions,
+    EventSetReportRate,
+    TRUE
 };
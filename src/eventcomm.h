@@ -38,6 +38,9 @@
 #define DEV_INPUT_EVENT "/dev/input"
 #define EVENT_DEV_NAME "event"
 
+/* Default for the ProbeCacheFile option */
+#define PROBE_CACHE_FILE "/var/cache/xorg/synaptics-probe"
+
 struct eventcomm_proto_data;
 
 extern struct eventcomm_proto_data *EventProtoDataAlloc(int fd);
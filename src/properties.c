@@ -81,6 +81,7 @@ Atom prop_circscroll_dist = 0;
 Atom prop_circscroll_trigger = 0;
 Atom prop_circpad = 0;
 Atom prop_palm = 0;
+Atom prop_absolute_hover = 0;
 Atom prop_palm_dim = 0;
 Atom prop_coastspeed = 0;
 Atom prop_pressuremotion = 0;
@@ -93,6 +94,16 @@ Atom prop_area = 0;
 Atom prop_softbutton_areas = 0;
 Atom prop_secondary_softbutton_areas = 0;
 Atom prop_noise_cancellation = 0;
+Atom prop_record = 0;
+Atom prop_accel_profile = 0;
+Atom prop_accel_points = 0;
+Atom prop_gesture_actions = 0;
+Atom prop_gesture_thresholds = 0;
+Atom prop_pressure_curve = 0;
+Atom prop_calibration = 0;
+Atom prop_calibration_learning = 0;
+Atom prop_report_rate = 0;
+Atom prop_absolute_zone = 0;
 Atom prop_product_id = 0;
 Atom prop_device_node = 0;
 
@@ -102,9 +113,9 @@ InitTypedAtom(DeviceIntPtr dev, char *name, Atom type, int format, int nvalues,
 {
     int i;
     Atom atom;
-    uint8_t val_8[9];           /* we never have more than 9 values in an atom */
-    uint16_t val_16[9];
-    uint32_t val_32[9];
+    uint8_t val_8[4 + CALIB_GRID_VALUES];       /* the calibration is the largest atom */
+    uint16_t val_16[4 + CALIB_GRID_VALUES];
+    uint32_t val_32[4 + CALIB_GRID_VALUES];
     pointer converted;
 
     for (i = 0; i < nvalues; i++) {
@@ -159,6 +170,45 @@ InitFloatAtom(DeviceIntPtr dev, char *name, int nvalues, float *values)
     return atom;
 }
 
+static void
+calibration_values(const SynapticsParameters * para, int *values)
+{
+    memcpy(values, para->calib_extents, 4 * sizeof(int));
+    memcpy(values + 4, para->calib_grid, CALIB_GRID_VALUES * sizeof(int));
+}
+
+static Atom
+InitCalibrationProperty(InputInfoPtr pInfo)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+    int values[4 + CALIB_GRID_VALUES];
+
+    calibration_values(&priv->synpara, values);
+    return InitAtom(pInfo->dev, SYNAPTICS_PROP_CALIBRATION, 32,
+                    4 + CALIB_GRID_VALUES, values);
+}
+
+/*
+ * Publish the learned calibration to its property so it can be saved and
+ * restored with the Calibration option. Must run in the main thread.
+ */
+void
+SynapticsPublishCalibration(InputInfoPtr pInfo)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+    int values[4 + CALIB_GRID_VALUES];
+    int sigstate;
+
+    sigstate = xf86BlockSIGIO();
+    calibration_values(&priv->synpara, values);
+    priv->learn.dirty = FALSE;
+    xf86UnblockSIGIO(sigstate);
+
+    XIChangeDeviceProperty(pInfo->dev, prop_calibration, XA_INTEGER, 32,
+                           PropModeReplace, 4 + CALIB_GRID_VALUES, values,
+                           TRUE);
+}
+
 static void
 InitSoftButtonProperty(InputInfoPtr pInfo)
 {
@@ -269,6 +319,13 @@ InitDeviceProperties(InputInfoPtr pInfo)
     fvalues[3] = 0;
     prop_speed = InitFloatAtom(pInfo->dev, SYNAPTICS_PROP_SPEED, 4, fvalues);
 
+    prop_accel_profile =
+        InitAtom(pInfo->dev, SYNAPTICS_PROP_ACCEL_PROFILE, 8, 1,
+                 &para->accel_profile);
+    prop_accel_points =
+        InitFloatAtom(pInfo->dev, SYNAPTICS_PROP_ACCEL_POINTS,
+                      2 * para->accel_num_points, para->accel_points);
+
     if (priv->has_scrollbuttons) {
         values[0] = para->updown_button_scrolling;
         values[1] = para->leftright_button_scrolling;
@@ -321,6 +378,10 @@ InitDeviceProperties(InputInfoPtr pInfo)
         InitAtom(pInfo->dev, SYNAPTICS_PROP_PALM_DETECT, 8, 1,
                  &para->palm_detect);
 
+    prop_absolute_hover =
+        InitAtom(pInfo->dev, SYNAPTICS_PROP_ABSOLUTE_HOVER, 8, 1,
+                 &para->absolute_hover);
+
     values[0] = para->palm_min_width;
     values[1] = para->palm_min_z;
 
@@ -373,6 +434,13 @@ InitDeviceProperties(InputInfoPtr pInfo)
     values[3] = para->area_bottom_edge;
     prop_area = InitAtom(pInfo->dev, SYNAPTICS_PROP_AREA, 32, 4, values);
 
+    values[0] = para->abs_zone_left_edge;
+    values[1] = para->abs_zone_right_edge;
+    values[2] = para->abs_zone_top_edge;
+    values[3] = para->abs_zone_bottom_edge;
+    prop_absolute_zone =
+        InitAtom(pInfo->dev, SYNAPTICS_PROP_ABSOLUTE_ZONE, 32, 4, values);
+
     if (para->clickpad)
         InitSoftButtonProperty(pInfo);
 
@@ -382,6 +450,36 @@ InitDeviceProperties(InputInfoPtr pInfo)
                                        SYNAPTICS_PROP_NOISE_CANCELLATION, 32, 2,
                                        values);
 
+    prop_record =
+        InitAtom(pInfo->dev, SYNAPTICS_PROP_RECORD, 8, 1, &para->record);
+
+    prop_gesture_actions =
+        InitAtom(pInfo->dev, SYNAPTICS_PROP_GESTURE_ACTIONS, 32, MAX_GESTURE,
+                 para->gesture_action);
+
+    values[0] = para->gesture_swipe_dist;
+    values[1] = para->gesture_pinch_ratio;
+    values[2] = para->gesture_rotate_angle;
+    prop_gesture_thresholds =
+        InitAtom(pInfo->dev, SYNAPTICS_PROP_GESTURE_THRESHOLDS, 32, 3, values);
+
+    if (priv->pressure.axis >= 0)
+        prop_pressure_curve =
+            InitAtom(pInfo->dev, SYNAPTICS_PROP_PRESSURE_CURVE, 32, 4,
+                     para->pressure_curve);
+
+    prop_calibration = InitCalibrationProperty(pInfo);
+
+    values[0] = para->calib_learn;
+    values[1] = para->calib_fit_grid;
+    prop_calibration_learning =
+        InitAtom(pInfo->dev, SYNAPTICS_PROP_CALIBRATION_LEARNING, 8, 2, values);
+
+    if (priv->proto_ops->SetReportRate)
+        prop_report_rate =
+            InitAtom(pInfo->dev, SYNAPTICS_PROP_REPORT_RATE, 8, 1,
+                     &para->report_rate);
+
     /* only init product_id property if we actually know them */
     if (priv->id_vendor || priv->id_product) {
         values[0] = priv->id_vendor;
@@ -558,6 +656,38 @@ SetProperty(DeviceIntPtr dev, Atom property, XIPropertyValuePtr prop,
         para->min_speed = speed[0];
         para->max_speed = speed[1];
         para->accl = speed[2];
+        if (!checkonly)
+            SynapticsUpdateAccelProfile(priv);
+    }
+    else if (property == prop_accel_profile) {
+        CARD8 profile;
+
+        if (prop->size != 1 || prop->format != 8 || prop->type != XA_INTEGER)
+            return BadMatch;
+
+        profile = *(CARD8 *) prop->data;
+        if (profile > ACCEL_MAX_PROFILE)
+            return BadValue;
+
+        para->accel_profile = profile;
+        if (!checkonly)
+            SynapticsUpdateAccelProfile(priv);
+    }
+    else if (property == prop_accel_points) {
+        float *points;
+
+        if (prop->size % 2 || prop->size > 2 * ACCEL_MAX_POINTS ||
+            prop->format != 32 || prop->type != float_type)
+            return BadMatch;
+
+        points = (float *) prop->data;
+        if (!SynapticsIsAccelPointsValid(points, prop->size / 2))
+            return BadValue;
+
+        memcpy(para->accel_points, points, prop->size * sizeof(float));
+        para->accel_num_points = prop->size / 2;
+        if (!checkonly)
+            SynapticsUpdateAccelProfile(priv);
     }
     else if (property == prop_buttonscroll) {
         BOOL *scroll;
@@ -700,6 +830,12 @@ SetProperty(DeviceIntPtr dev, Atom property, XIPropertyValuePtr prop,
 
         para->palm_detect = *(BOOL *) prop->data;
     }
+    else if (property == prop_absolute_hover) {
+        if (prop->size != 1 || prop->format != 8 || prop->type != XA_INTEGER)
+            return BadMatch;
+
+        para->absolute_hover = *(BOOL *) prop->data;
+    }
     else if (property == prop_palm_dim) {
         INT32 *dim;
 
@@ -777,6 +913,22 @@ SetProperty(DeviceIntPtr dev, Atom property, XIPropertyValuePtr prop,
         para->area_top_edge = area[2];
         para->area_bottom_edge = area[3];
     }
+    else if (property == prop_absolute_zone) {
+        INT32 *zone;
+
+        if (prop->size != 4 || prop->format != 32 || prop->type != XA_INTEGER)
+            return BadMatch;
+
+        zone = (INT32 *) prop->data;
+        if ((((zone[0] != 0) && (zone[1] != 0)) && (zone[0] > zone[1])) ||
+            (((zone[2] != 0) && (zone[3] != 0)) && (zone[2] > zone[3])))
+            return BadValue;
+
+        para->abs_zone_left_edge = zone[0];
+        para->abs_zone_right_edge = zone[1];
+        para->abs_zone_top_edge = zone[2];
+        para->abs_zone_bottom_edge = zone[3];
+    }
     else if (property == prop_softbutton_areas) {
         int *areas;
 
@@ -815,6 +967,123 @@ SetProperty(DeviceIntPtr dev, Atom property, XIPropertyValuePtr prop,
         para->hyst_x = hyst[0];
         para->hyst_y = hyst[1];
     }
+    else if (property == prop_record) {
+        CARD8 record;
+
+        if (prop->size != 1 || prop->format != 8 || prop->type != XA_INTEGER)
+            return BadMatch;
+
+        record = *(CARD8 *) prop->data;
+        if (record > 1)
+            return BadValue;
+
+        /* Nowhere to record to */
+        if (record && !priv->record_file)
+            return BadMatch;
+
+        if (!checkonly && dev->public.on &&
+            !SynapticsSetRecording(pInfo, record))
+            return BadAccess;
+
+        para->record = record;
+    }
+    else if (property == prop_gesture_actions) {
+        int i;
+        INT32 *action;
+
+        if (prop->size > MAX_GESTURE || prop->format != 32 ||
+            prop->type != XA_INTEGER)
+            return BadMatch;
+
+        action = (INT32 *) prop->data;
+        for (i = 0; i < prop->size; i++)
+            if (action[i] < GESTURE_SCROLL_RIGHT ||
+                action[i] > SYN_MAX_BUTTONS)
+                return BadValue;
+
+        for (i = 0; i < prop->size; i++)
+            para->gesture_action[i] = action[i];
+    }
+    else if (property == prop_gesture_thresholds) {
+        INT32 *thresholds;
+
+        if (prop->size != 3 || prop->format != 32 || prop->type != XA_INTEGER)
+            return BadMatch;
+
+        thresholds = (INT32 *) prop->data;
+        if (thresholds[0] < 0 || thresholds[1] < 0 || thresholds[2] < 0)
+            return BadValue;
+
+        para->gesture_swipe_dist = thresholds[0];
+        para->gesture_pinch_ratio = thresholds[1];
+        para->gesture_rotate_angle = thresholds[2];
+    }
+    else if (property == prop_pressure_curve) {
+        int curve[4];
+        int i;
+
+        if (prop->size != 4 || prop->format != 32 || prop->type != XA_INTEGER)
+            return BadMatch;
+
+        for (i = 0; i < 4; i++)
+            curve[i] = ((INT32 *) prop->data)[i];
+        if (!SynapticsIsPressureCurveValid(curve))
+            return BadValue;
+
+        for (i = 0; i < 4; i++)
+            para->pressure_curve[i] = curve[i];
+        if (!checkonly)
+            SynapticsUpdatePressureCurve(priv);
+    }
+    else if (property == prop_calibration) {
+        INT32 *calib;
+        int extents[4];
+        int i;
+
+        if ((prop->size != 4 && prop->size != 4 + CALIB_GRID_VALUES) ||
+            prop->format != 32 || prop->type != XA_INTEGER)
+            return BadMatch;
+
+        calib = (INT32 *) prop->data;
+        for (i = 0; i < 4; i++)
+            extents[i] = calib[i];
+        if (!SynapticsIsCalibrationValid(extents))
+            return BadValue;
+
+        for (i = 0; i < 4; i++)
+            para->calib_extents[i] = extents[i];
+        for (i = 0; i < CALIB_GRID_VALUES; i++)
+            para->calib_grid[i] = (prop->size > 4) ? calib[4 + i] : 0;
+        if (!checkonly)
+            SynapticsUpdateCalibration(priv);
+    }
+    else if (property == prop_calibration_learning) {
+        BOOL *learn;
+
+        if (prop->size != 2 || prop->format != 8 || prop->type != XA_INTEGER)
+            return BadMatch;
+
+        learn = (BOOL *) prop->data;
+        if (!checkonly) {
+            /* Start from scratch when learning is switched on */
+            if (learn[0] && !para->calib_learn)
+                SynapticsResetCalibrationLearning(priv);
+            para->calib_learn = learn[0];
+            para->calib_fit_grid = learn[1];
+        }
+    }
+    else if (property == prop_report_rate) {
+        CARD8 rate;
+
+        if (prop->size != 1 || prop->format != 8 || prop->type != XA_INTEGER)
+            return BadMatch;
+
+        rate = *(CARD8 *) prop->data;
+        if (rate > RATE_MAX)
+            return BadValue;
+
+        para->report_rate = rate;
+    }
     else if (property == prop_product_id || property == prop_device_node)
         return BadValue;        /* read-only */
     else { /* unknown property */
@@ -828,5 +1097,8 @@ SetProperty(DeviceIntPtr dev, Atom property, XIPropertyValuePtr prop,
         }
     }
 
+    if (!checkonly)
+        SynapticsSelectHandleState(priv);
+
     return Success;
 }
@@ -42,7 +42,7 @@
 #include "ps2comm.h"
 #include <xf86.h>
 
-#define MAX_UNSYNC_PACKETS 10   /* i.e. 10 to 60 bytes */
+#define MAX_UNSYNC_PACKETS 10   /* consecutive bytes skipped before a reset */
 /*
  * The x/y limits are taken from the Synaptics TouchPad interfacing Guide,
  * section 2.3.2, which says that they should be valid regardless of the
@@ -89,7 +89,7 @@
 /*
  * Read a byte from the ps/2 port
  */
-static Bool
+Bool
 ps2_getbyte(int fd, byte * b)
 {
     if (xf86WaitForInput(fd, 50000) > 0) {
@@ -373,16 +373,37 @@ ps2_print_ident(InputInfoPtr pInfo, const struct PS2SynapticsHwInfo *synhw)
 static Bool
 PS2DeviceOffHook(InputInfoPtr pInfo)
 {
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+
+    if (priv->proto_data)
+        ps2_recovery_cancel(priv->proto_data);
+
     ps2_synaptics_reset(pInfo->fd);
     ps2_synaptics_enable_device(pInfo->fd);
 
     return TRUE;
 }
 
+/*
+ * The mode byte the driver runs the touchpad in
+ */
+static byte
+ps2_synaptics_mode(const struct PS2SynapticsHwInfo *synhw)
+{
+    byte mode = SYN_BIT_ABSOLUTE_MODE;
+
+    if (!synhw->low_rate)
+        mode |= SYN_BIT_HIGH_RATE;
+    if (SYN_ID_MAJOR(synhw) >= 4)
+        mode |= SYN_BIT_DISABLE_GESTURE;
+    if (SYN_CAP_EXTENDED(synhw))
+        mode |= SYN_BIT_W_MODE;
+    return mode;
+}
+
 static Bool
 PS2QueryHardware(InputInfoPtr pInfo)
 {
-    int mode;
     SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
     struct PS2SynapticsHwInfo *synhw;
 
@@ -390,6 +411,11 @@ PS2QueryHardware(InputInfoPtr pInfo)
         priv->proto_data = calloc(1, sizeof(struct PS2SynapticsHwInfo));
     synhw = (struct PS2SynapticsHwInfo *) priv->proto_data;
 
+    /* allocate now so we don't allocate in the signal handler */
+    if (!synhw->recovery.timer)
+        synhw->recovery.timer = TimerSet(NULL, 0, 0, NULL, NULL);
+    synhw->recovery.state = PS2_RECOVERY_IDLE;
+
     /* is the synaptics touchpad active? */
     if (!ps2_query_is_synaptics(pInfo, pInfo->fd, synhw))
         return FALSE;
@@ -408,12 +434,10 @@ PS2QueryHardware(InputInfoPtr pInfo)
     if (!ps2_synaptics_capability(pInfo->fd, synhw))
         return FALSE;
 
-    mode = SYN_BIT_ABSOLUTE_MODE | SYN_BIT_HIGH_RATE;
-    if (SYN_ID_MAJOR(synhw) >= 4)
-        mode |= SYN_BIT_DISABLE_GESTURE;
-    if (SYN_CAP_EXTENDED(synhw))
-        mode |= SYN_BIT_W_MODE;
-    if (!ps2_synaptics_set_mode(pInfo->fd, mode))
+    ps2_setup_decoder(synhw);
+
+    synhw->low_rate = FALSE;
+    if (!ps2_synaptics_set_mode(pInfo->fd, ps2_synaptics_mode(synhw)))
         return FALSE;
 
     ps2_synaptics_enable_device(pInfo->fd);
@@ -423,198 +447,580 @@ PS2QueryHardware(InputInfoPtr pInfo)
     return TRUE;
 }
 
+/*****************************************************************************
+ *	Asynchronous recovery
+ *
+ * The same steps as PS2QueryHardware, but every command byte is written
+ * from the input handler when the previous one has been acknowledged and a
+ * timer catches a touchpad that doesn't answer.
+ ****************************************************************************/
+
+enum {
+    PS2_STAGE_DISABLE,
+    PS2_STAGE_RESET,
+    PS2_STAGE_IDENTIFY,
+    PS2_STAGE_MODEL,
+    PS2_STAGE_CAPABILITIES,
+    PS2_STAGE_EXT_CAPABILITIES,
+    PS2_STAGE_SET_MODE,
+    PS2_STAGE_ENABLE,
+};
+
+#define PS2_CMD_TIMEOUT		50      /* ms to wait for an answer */
+#define PS2_RESET_TIMEOUT	4000    /* ms to wait for a reset to finish */
+#define PS2_CHECK_RESET_TIMEOUT	50      /* ms of silence after 0xAA 0x00 */
+#define PS2_RECOVERY_ATTEMPTS	3
+
+static CARD32 ps2_recovery_timeout(OsTimerPtr timer, CARD32 now, pointer arg);
+
 /*
- * Decide if the current packet stored in priv->protoBuf is valid.
+ * Put the special command sequence for cmd into script, see
+ * ps2_special_cmd. Returns the number of bytes.
  */
-static Bool
-ps2_packet_ok(struct PS2SynapticsHwInfo *synhw, struct CommData *comm)
+static int
+ps2_special_script(byte *script, byte cmd)
 {
-    unsigned char *buf = comm->protoBuf;
-    int newabs = SYN_MODEL_NEWABS(synhw);
+    int i, n = 0;
 
-    if (newabs ? ((buf[0] & 0xC0) != 0x80) : ((buf[0] & 0xC0) != 0xC0)) {
-        PS2DBG("Synaptics driver lost sync at 1st byte\n");
-        return FALSE;
+    script[n++] = PS2_CMD_SET_SCALING_1_1;
+    for (i = 0; i < 4; i++) {
+        script[n++] = PS2_CMD_SET_RESOLUTION;
+        script[n++] = (cmd >> 6) & 0x3;
+        cmd <<= 2;
     }
+    return n;
+}
 
-    if (!newabs && ((buf[1] & 0x60) != 0x00)) {
-        PS2DBG("Synaptics driver lost sync at 2nd byte\n");
-        return FALSE;
+static void
+ps2_recovery_arm(InputInfoPtr pInfo, struct PS2Recovery *rec, int timeout)
+{
+    rec->timer = TimerSet(rec->timer, 0, timeout, ps2_recovery_timeout, pInfo);
+}
+
+static void ps2_recovery_stage(InputInfoPtr pInfo,
+                               struct PS2SynapticsHwInfo *synhw, int stage);
+
+/*
+ * Give up on this attempt and start over, or leave the touchpad alone
+ * until the next DeviceOn if it keeps failing.
+ */
+static void
+ps2_recovery_fail(InputInfoPtr pInfo, struct PS2SynapticsHwInfo *synhw)
+{
+    struct PS2Recovery *rec = &synhw->recovery;
+    byte enable = PS2_CMD_ENABLE;
+
+    PS2DBG("Recovery failed in stage %d\n", rec->stage);
+
+    if (++rec->attempts < PS2_RECOVERY_ATTEMPTS) {
+        ps2_recovery_stage(pInfo, synhw, PS2_STAGE_DISABLE);
+        return;
     }
 
-    if ((newabs ? ((buf[3] & 0xC0) != 0xC0) : ((buf[3] & 0xC0) != 0x80))) {
-        PS2DBG("Synaptics driver lost sync at 4th byte\n");
-        return FALSE;
+    LogMessageVerbSigSafe(X_ERROR, 0,
+                          "Synaptics touchpad reinitialization failed\n");
+    TimerCancel(rec->timer);
+    rec->state = PS2_RECOVERY_FAILED;
+    rec->mode_only = FALSE;
+
+    /* Try to get a packet stream again, the ACK is skipped by the resync */
+    xf86WriteSerial(pInfo->fd, &enable, 1);
+}
+
+/*
+ * Write the next command byte of the current stage.
+ */
+static void
+ps2_recovery_send(InputInfoPtr pInfo, struct PS2SynapticsHwInfo *synhw)
+{
+    struct PS2Recovery *rec = &synhw->recovery;
+
+    if (xf86WriteSerial(pInfo->fd, &rec->script[rec->pos], 1) != 1) {
+        ps2_recovery_fail(pInfo, synhw);
+        return;
     }
+    rec->pos++;
+    rec->want_ack = TRUE;
+    ps2_recovery_arm(pInfo, rec, rec->stage == PS2_STAGE_RESET &&
+                     rec->pos == rec->script_len ?
+                     PS2_RESET_TIMEOUT : PS2_CMD_TIMEOUT);
+}
 
-    if (!newabs && ((buf[4] & 0x60) != 0x00)) {
-        PS2DBG("Synaptics driver lost sync at 5th byte\n");
-        return FALSE;
+/*
+ * Set up the commands of a stage and send the first one.
+ */
+static void
+ps2_recovery_stage(InputInfoPtr pInfo, struct PS2SynapticsHwInfo *synhw,
+                   int stage)
+{
+    struct PS2Recovery *rec = &synhw->recovery;
+    int n = 0;
+
+    rec->stage = stage;
+    rec->want_reply = 0;
+
+    switch (stage) {
+    case PS2_STAGE_DISABLE:
+        rec->script[n++] = PS2_CMD_DISABLE;
+        break;
+    case PS2_STAGE_RESET:
+        rec->script[n++] = PS2_CMD_RESET;
+        rec->want_reply = 2;
+        break;
+    case PS2_STAGE_IDENTIFY:
+        n = ps2_special_script(rec->script, SYN_QUE_IDENTIFY);
+        rec->script[n++] = PS2_CMD_STATUS_REQUEST;
+        rec->want_reply = 3;
+        break;
+    case PS2_STAGE_MODEL:
+        n = ps2_special_script(rec->script, SYN_QUE_MODEL);
+        rec->script[n++] = PS2_CMD_STATUS_REQUEST;
+        rec->want_reply = 3;
+        break;
+    case PS2_STAGE_CAPABILITIES:
+        n = ps2_special_script(rec->script, SYN_QUE_CAPABILITIES);
+        rec->script[n++] = PS2_CMD_STATUS_REQUEST;
+        rec->want_reply = 3;
+        break;
+    case PS2_STAGE_EXT_CAPABILITIES:
+        n = ps2_special_script(rec->script, SYN_QUE_EXT_CAPAB);
+        rec->script[n++] = PS2_CMD_STATUS_REQUEST;
+        rec->want_reply = 3;
+        break;
+    case PS2_STAGE_SET_MODE:
+        n = ps2_special_script(rec->script, ps2_synaptics_mode(synhw));
+        rec->script[n++] = PS2_CMD_SET_SAMPLE_RATE;
+        rec->script[n++] = 0x14;
+        break;
+    case PS2_STAGE_ENABLE:
+        rec->script[n++] = PS2_CMD_ENABLE;
+        break;
     }
 
+    rec->script_len = n;
+    rec->pos = 0;
+    rec->nreply = 0;
+    ps2_recovery_send(pInfo, synhw);
+}
+
+/*
+ * All commands of the current stage are acknowledged and the answer is
+ * complete. Check it and go on with the next stage.
+ */
+static void
+ps2_recovery_stage_done(InputInfoPtr pInfo, struct PS2SynapticsHwInfo *synhw)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+    struct PS2Recovery *rec = &synhw->recovery;
+    unsigned int r = (rec->reply[0] << 16) | (rec->reply[1] << 8) |
+        rec->reply[2];
+
+    switch (rec->stage) {
+    case PS2_STAGE_DISABLE:
+        ps2_recovery_stage(pInfo, synhw, rec->mode_only ?
+                           PS2_STAGE_SET_MODE : PS2_STAGE_RESET);
+        break;
+    case PS2_STAGE_RESET:
+        if (rec->reply[0] != 0xAA || rec->reply[1] != 0x00) {
+            ps2_recovery_fail(pInfo, synhw);
+            break;
+        }
+        ps2_recovery_stage(pInfo, synhw, PS2_STAGE_IDENTIFY);
+        break;
+    case PS2_STAGE_IDENTIFY:
+        synhw->identity = r;
+        if (!SYN_ID_IS_SYNAPTICS(synhw)) {
+            ps2_recovery_fail(pInfo, synhw);
+            break;
+        }
+        ps2_recovery_stage(pInfo, synhw, PS2_STAGE_MODEL);
+        break;
+    case PS2_STAGE_MODEL:
+        synhw->model_id = r;
+        ps2_recovery_stage(pInfo, synhw, PS2_STAGE_CAPABILITIES);
+        break;
+    case PS2_STAGE_CAPABILITIES:
+        synhw->capabilities = r;
+        synhw->ext_cap = 0;
+        if (!SYN_CAP_VALID(synhw)) {
+            ps2_recovery_fail(pInfo, synhw);
+            break;
+        }
+        if (SYN_EXT_CAP_REQUESTS(synhw))
+            ps2_recovery_stage(pInfo, synhw, PS2_STAGE_EXT_CAPABILITIES);
+        else {
+            ps2_setup_decoder(synhw);
+            ps2_recovery_stage(pInfo, synhw, PS2_STAGE_SET_MODE);
+        }
+        break;
+    case PS2_STAGE_EXT_CAPABILITIES:
+        synhw->ext_cap = r;
+        ps2_setup_decoder(synhw);
+        ps2_recovery_stage(pInfo, synhw, PS2_STAGE_SET_MODE);
+        break;
+    case PS2_STAGE_SET_MODE:
+        ps2_recovery_stage(pInfo, synhw, PS2_STAGE_ENABLE);
+        break;
+    case PS2_STAGE_ENABLE:
+        TimerCancel(rec->timer);
+        rec->state = PS2_RECOVERY_IDLE;
+        priv->comm.ringHead = priv->comm.ringTail;
+        priv->comm.outOfSync = 0;
+        if (rec->mode_only)
+            rec->mode_only = FALSE;
+        else
+            LogMessageVerbSigSafe(X_INFO, 3,
+                                  "Synaptics touchpad reinitialized\n");
+        break;
+    }
+}
+
+/*
+ * Feed one byte read from the touchpad into the recovery.
+ */
+static void
+ps2_recovery_byte(InputInfoPtr pInfo, struct PS2SynapticsHwInfo *synhw,
+                  byte b)
+{
+    struct PS2Recovery *rec = &synhw->recovery;
+
+    if (rec->want_ack) {
+        if (b != PS2_ACK) {
+            /* Packets still in flight before the touchpad is disabled */
+            if (rec->stage == PS2_STAGE_DISABLE)
+                return;
+            PS2DBG("Recovery: wrong acknowledge 0x%02x\n", b);
+            ps2_recovery_fail(pInfo, synhw);
+            return;
+        }
+        rec->want_ack = FALSE;
+        if (rec->pos < rec->script_len)
+            ps2_recovery_send(pInfo, synhw);
+        else if (rec->want_reply == 0)
+            ps2_recovery_stage_done(pInfo, synhw);
+        return;
+    }
+
+    if (rec->nreply < rec->want_reply) {
+        rec->reply[rec->nreply++] = b;
+        if (rec->nreply == rec->want_reply)
+            ps2_recovery_stage_done(pInfo, synhw);
+    }
+}
+
+/*
+ * Start reinitializing the touchpad. If it reset itself, the reset is
+ * skipped.
+ */
+static void
+ps2_recovery_start(InputInfoPtr pInfo, struct PS2SynapticsHwInfo *synhw,
+                   Bool was_reset)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+    struct PS2Recovery *rec = &synhw->recovery;
+
+    /* whatever came before is stale */
+    priv->comm.ringHead = priv->comm.ringTail;
+    priv->comm.outOfSync = 0;
+
+    /* The kernel driver talks to the device for psm, QueryHardware is only
+     * a few ioctls there */
+    if (rec->proto_ops != &psaux_proto_operations) {
+        TimerCancel(rec->timer);
+        rec->state = PS2_RECOVERY_IDLE;
+        rec->proto_ops->QueryHardware(pInfo);
+        return;
+    }
+
+    rec->state = PS2_RECOVERY_RUNNING;
+    rec->attempts = 0;
+    rec->mode_only = FALSE;
+    ps2_recovery_stage(pInfo, synhw,
+                       was_reset ? PS2_STAGE_IDENTIFY : PS2_STAGE_DISABLE);
+}
+
+/*
+ * Switch between 40 and 80 packets/s. The mode byte is rewritten with the
+ * touchpad disabled, like in the recovery, so no packets get in between
+ * the acknowledges. Returns FALSE if the touchpad is busy, the caller tries
+ * again with the next frame.
+ */
+static Bool
+PS2SetReportRate(InputInfoPtr pInfo, Bool high)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+    struct PS2SynapticsHwInfo *synhw = priv->proto_data;
+    struct PS2Recovery *rec = &synhw->recovery;
+
+    if (rec->state != PS2_RECOVERY_IDLE || !rec->timer)
+        return FALSE;
+
+    if (synhw->low_rate == !high)
+        return TRUE;
+
+    synhw->low_rate = !high;
+    rec->state = PS2_RECOVERY_RUNNING;
+    rec->attempts = 0;
+    rec->mode_only = TRUE;
+    ps2_recovery_stage(pInfo, synhw, PS2_STAGE_DISABLE);
     return TRUE;
 }
 
+static CARD32
+ps2_recovery_timeout(OsTimerPtr timer, CARD32 now, pointer arg)
+{
+    InputInfoPtr pInfo = arg;
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+    struct PS2SynapticsHwInfo *synhw = priv->proto_data;
+    int sigstate;
+
+    sigstate = xf86BlockSIGIO();
+
+    if (synhw->recovery.state == PS2_RECOVERY_CHECK_RESET) {
+        PS2DBG("Reset received\n");
+        ps2_recovery_start(pInfo, synhw, TRUE);
+    }
+    else if (synhw->recovery.state == PS2_RECOVERY_RUNNING) {
+        PS2DBG("Recovery: timeout\n");
+        ps2_recovery_fail(pInfo, synhw);
+    }
+
+    xf86UnblockSIGIO(sigstate);
+
+    return 0;
+}
+
+void
+ps2_recovery_cancel(struct PS2SynapticsHwInfo *synhw)
+{
+    TimerFree(synhw->recovery.timer);
+    synhw->recovery.timer = NULL;
+    synhw->recovery.state = PS2_RECOVERY_IDLE;
+}
+
+/*
+ * Mask and expected value for each byte of a valid packet
+ */
+static const unsigned char ps2_newabs_mask[6] = { 0xC0, 0x00, 0x00, 0xC0, 0x00, 0x00 };
+static const unsigned char ps2_newabs_bits[6] = { 0x80, 0x00, 0x00, 0xC0, 0x00, 0x00 };
+static const unsigned char ps2_oldabs_mask[6] = { 0xC0, 0x60, 0x00, 0xC0, 0x60, 0x00 };
+static const unsigned char ps2_oldabs_bits[6] = { 0xC0, 0x00, 0x00, 0x80, 0x00, 0x00 };
+
+/*
+ * Decide if the six bytes starting at pos in the ring form a valid packet.
+ */
 static Bool
-ps2_synaptics_get_packet(InputInfoPtr pInfo, struct PS2SynapticsHwInfo *synhw,
-                         struct SynapticsProtocolOperations *proto_ops,
-                         struct CommData *comm)
+ps2_packet_ok(struct PS2SynapticsHwInfo *synhw, struct CommData *comm,
+              unsigned int pos)
 {
-    int count = 0;
+    const unsigned char *mask, *bits;
+    int i;
+
+    if (SYN_MODEL_NEWABS(synhw)) {
+        mask = ps2_newabs_mask;
+        bits = ps2_newabs_bits;
+    }
+    else {
+        mask = ps2_oldabs_mask;
+        bits = ps2_oldabs_bits;
+    }
+
+    for (i = 0; i < 6; i++)
+        if ((COMM_RING_BYTE(comm, pos + i) & mask[i]) != bits[i])
+            return FALSE;
+
+    return TRUE;
+}
+
+/*
+ * Move everything that is available from the device into the ring.
+ */
+static void
+ps2_fill_ring(InputInfoPtr pInfo, struct PS2SynapticsHwInfo *synhw,
+              struct SynapticsProtocolOperations *proto_ops,
+              struct CommData *comm)
+{
+    struct PS2Recovery *rec = &synhw->recovery;
     int c;
-    unsigned char u;
 
-    while ((c = XisbRead(comm->buffer)) >= 0) {
-        u = (unsigned char) c;
+    while (comm->ringTail - comm->ringHead < COMM_RING_SIZE &&
+           (c = SynapticsCommRead(comm)) >= 0) {
+        unsigned char u = (unsigned char) c;
 
-        /* test if there is a reset sequence received */
-        if ((c == 0x00) && (comm->lastByte == 0xAA)) {
-            if (xf86WaitForInput(pInfo->fd, 50000) == 0) {
-                PS2DBG("Reset received\n");
-                proto_ops->QueryHardware(pInfo);
-            }
-            else
-                PS2DBG("faked reset received\n");
+        if (rec->state == PS2_RECOVERY_RUNNING) {
+            ps2_recovery_byte(pInfo, synhw, u);
+            continue;
         }
-        comm->lastByte = u;
 
-        /* to avoid endless loops */
-        if (count++ > 30) {
-            LogMessageVerbSigSafe(X_ERROR, 0,
-                                  "Synaptics driver lost sync... got gigantic packet!\n");
-            return FALSE;
+        if (rec->state == PS2_RECOVERY_CHECK_RESET) {
+            PS2DBG("faked reset received\n");
+            TimerCancel(rec->timer);
+            rec->state = PS2_RECOVERY_IDLE;
         }
 
-        comm->protoBuf[comm->protoBufTail++] = u;
-
-        /* Check that we have a valid packet. If not, we are out of sync,
-           so we throw away the first byte in the packet. */
-        if (comm->protoBufTail >= 6) {
-            if (!ps2_packet_ok(synhw, comm)) {
-                int i;
-
-                for (i = 0; i < comm->protoBufTail - 1; i++)
-                    comm->protoBuf[i] = comm->protoBuf[i + 1];
-                comm->protoBufTail--;
-                comm->outOfSync++;
-                if (comm->outOfSync > MAX_UNSYNC_PACKETS) {
-                    comm->outOfSync = 0;
-                    PS2DBG("Synaptics synchronization lost too long -> reset touchpad.\n");
-                    proto_ops->QueryHardware(pInfo);    /* including a reset */
-                    continue;
-                }
-            }
+        /* test if there is a reset sequence received, it is real if
+         * nothing follows for a while */
+        if ((c == 0x00) && (comm->lastByte == 0xAA) &&
+            rec->state != PS2_RECOVERY_FAILED) {
+            rec->state = PS2_RECOVERY_CHECK_RESET;
+            rec->proto_ops = proto_ops;
+            ps2_recovery_arm(pInfo, rec, PS2_CHECK_RESET_TIMEOUT);
         }
+        comm->lastByte = u;
+
+        COMM_RING_BYTE(comm, comm->ringTail++) = u;
+    }
+}
+
+/*
+ * Frame the next packet from the ring into comm->protoBuf. Bytes that
+ * can't start a valid packet are skipped one at a time, so regaining sync
+ * is linear in the amount of garbage.
+ */
+static Bool
+ps2_synaptics_get_packet(InputInfoPtr pInfo, struct PS2SynapticsHwInfo *synhw,
+                         struct SynapticsProtocolOperations *proto_ops,
+                         struct CommData *comm)
+{
+    Bool found = FALSE;
+    int i;
+
+    comm->resyncBytes = 0;
+    ps2_fill_ring(pInfo, synhw, proto_ops, comm);
+
+    while (synhw->recovery.state != PS2_RECOVERY_RUNNING &&
+           comm->ringTail - comm->ringHead >= 6) {
+        if (ps2_packet_ok(synhw, comm, comm->ringHead)) {
+            for (i = 0; i < 6; i++)
+                comm->protoBuf[i] = COMM_RING_BYTE(comm, comm->ringHead + i);
+            comm->ringHead += 6;
 
-        if (comm->protoBufTail >= 6) {  /* Full packet received */
             if (comm->outOfSync > 0) {
                 comm->outOfSync = 0;
                 PS2DBG("Synaptics driver resynced.\n");
             }
-            comm->protoBufTail = 0;
-            return TRUE;
+            found = TRUE;
+            break;
+        }
+
+        /* We are out of sync, so we throw away the first byte. */
+        comm->ringHead++;
+        comm->resyncBytes++;
+        if (++comm->outOfSync > MAX_UNSYNC_PACKETS) {
+            comm->outOfSync = 0;
+            /* A touchpad that failed to come back is left alone */
+            if (synhw->recovery.state == PS2_RECOVERY_FAILED)
+                continue;
+            PS2DBG("Synaptics synchronization lost too long -> reset touchpad.\n");
+            synhw->recovery.proto_ops = proto_ops;
+            ps2_recovery_start(pInfo, synhw, FALSE);    /* including a reset */
+            ps2_fill_ring(pInfo, synhw, proto_ops, comm);
         }
     }
 
-    return FALSE;
+    if (comm->resyncBytes > 0)
+        LogMessageVerbSigSafe(X_INFO, 7,
+                              "Synaptics driver dropped %d bytes to resync\n",
+                              comm->resyncBytes);
+
+    return found;
 }
 
-Bool
-PS2ReadHwStateProto(InputInfoPtr pInfo,
-                    struct SynapticsProtocolOperations *proto_ops,
-                    struct CommData *comm, struct SynapticsHwState *hwRet)
+/*
+ * Packet decoders, one per protocol variant. They only extract the raw
+ * values; everything that depends on the capabilities has been turned into
+ * masks and tables by ps2_setup_decoder().
+ */
+static void
+ps2_decode_oldabs(const struct PS2SynapticsHwInfo *synhw,
+                  const unsigned char *buf, struct SynapticsHwState *hw, int *w)
 {
-    unsigned char *buf = comm->protoBuf;
-    struct SynapticsHwState *hw = comm->hwState;
-    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
-    SynapticsParameters *para = &priv->synpara;
-    struct PS2SynapticsHwInfo *synhw;
-    int newabs;
-    int w, i;
+    hw->x = (((buf[1] & 0x1F) << 8) | buf[2]);
+    hw->y = (((buf[4] & 0x1F) << 8) | buf[5]);
 
-    synhw = (struct PS2SynapticsHwInfo *) priv->proto_data;
-    if (!synhw) {
-        LogMessageVerbSigSafe(X_ERROR, 0,
-                              "PS2ReadHwState, synhw is NULL. This is a bug.\n");
-        return FALSE;
-    }
+    hw->z = (((buf[0] & 0x30) << 2) | (buf[3] & 0x3F));
+    *w = (((buf[1] & 0x80) >> 4) | ((buf[0] & 0x04) >> 1));
 
-    newabs = SYN_MODEL_NEWABS(synhw);
+    hw->left = (buf[0] & 0x01) ? 1 : 0;
+    hw->right = (buf[0] & 0x02) ? 1 : 0;
+}
 
-    if (!ps2_synaptics_get_packet(pInfo, synhw, proto_ops, comm))
-        return FALSE;
+static void
+ps2_decode_newabs(const struct PS2SynapticsHwInfo *synhw,
+                  const unsigned char *buf, struct SynapticsHwState *hw, int *w)
+{
+    hw->x = (((buf[3] & 0x10) << 8) | ((buf[1] & 0x0f) << 8) | buf[4]);
+    hw->y = (((buf[3] & 0x20) << 7) | ((buf[1] & 0xf0) << 4) | buf[5]);
 
-    /* Handle normal packets */
-    hw->x = hw->y = hw->z = hw->numFingers = hw->fingerWidth = 0;
-    hw->left = hw->right = hw->up = hw->down = hw->middle = FALSE;
-    for (i = 0; i < 8; i++)
-        hw->multi[i] = FALSE;
+    hw->z = buf[2];
+    *w = (((buf[0] & 0x30) >> 2) |
+          ((buf[0] & 0x04) >> 1) | ((buf[3] & 0x04) >> 2));
 
-    if (newabs) {               /* newer protos... */
-        PS2DBG("using new protocols\n");
-        hw->x = (((buf[3] & 0x10) << 8) | ((buf[1] & 0x0f) << 8) | buf[4]);
-        hw->y = (((buf[3] & 0x20) << 7) | ((buf[1] & 0xf0) << 4) | buf[5]);
+    hw->left = (buf[0] & 0x01) ? 1 : 0;
+    hw->right = (buf[0] & 0x02) ? 1 : 0;
+}
 
-        hw->z = buf[2];
-        w = (((buf[0] & 0x30) >> 2) |
-             ((buf[0] & 0x04) >> 1) | ((buf[3] & 0x04) >> 2));
+static void
+ps2_decode_newabs_ext(const struct PS2SynapticsHwInfo *synhw,
+                      const unsigned char *buf, struct SynapticsHwState *hw,
+                      int *w)
+{
+    ps2_decode_newabs(synhw, buf, hw, w);
+
+    hw->middle = ((buf[0] ^ buf[3]) & synhw->middle_mask) ? 1 : 0;
+    hw->up = ((buf[3] ^ hw->left) & synhw->four_button_mask) ? 1 : 0;
+    hw->down = (((buf[3] >> 1) ^ hw->right) & synhw->four_button_mask) ? 1 : 0;
+
+    if (synhw->multi_mask && ((buf[3] & 2) ? !hw->right : hw->right)) {
+        unsigned char b4 = buf[4] & synhw->multi_mask;
+        unsigned char b5 = buf[5] & synhw->multi_mask;
+
+        hw->multi[0] = b4 & 0x01;
+        hw->multi[1] = b5 & 0x01;
+        hw->multi[2] = (b4 >> 1) & 0x01;
+        hw->multi[3] = (b5 >> 1) & 0x01;
+        hw->multi[4] = (b4 >> 2) & 0x01;
+        hw->multi[5] = (b5 >> 2) & 0x01;
+        hw->multi[6] = (b4 >> 3) & 0x01;
+        hw->multi[7] = (b5 >> 3) & 0x01;
+    }
+}
 
-        hw->left = (buf[0] & 0x01) ? 1 : 0;
-        hw->right = (buf[0] & 0x02) ? 1 : 0;
+/* Bits in bytes 4 and 5 used by 0-15 multi buttons. More than 9 buttons
+ * is not a known layout, those get none. */
+static const unsigned char ps2_multi_button_mask[16] = {
+    0x00, 0x00, 0x01, 0x01, 0x03, 0x03, 0x07, 0x07,
+    0x0f, 0x0f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
 
-        if (SYN_CAP_EXTENDED(synhw)) {
-            if (SYN_CAP_MIDDLE_BUTTON(synhw)) {
-                hw->middle = ((buf[0] ^ buf[3]) & 0x01) ? 1 : 0;
-            }
-            if (SYN_CAP_FOUR_BUTTON(synhw)) {
-                hw->up = ((buf[3] & 0x01)) ? 1 : 0;
-                if (hw->left)
-                    hw->up = !hw->up;
-                hw->down = ((buf[3] & 0x02)) ? 1 : 0;
-                if (hw->right)
-                    hw->down = !hw->down;
-            }
-            if (SYN_CAP_MULTI_BUTTON_NO(synhw)) {
-                if ((buf[3] & 2) ? !hw->right : hw->right) {
-                    switch (SYN_CAP_MULTI_BUTTON_NO(synhw) & ~0x01) {
-                    default:
-                        break;
-                    case 8:
-                        hw->multi[7] = ((buf[5] & 0x08)) ? 1 : 0;
-                        hw->multi[6] = ((buf[4] & 0x08)) ? 1 : 0;
-                        /* fallthrough */
-                    case 6:
-                        hw->multi[5] = ((buf[5] & 0x04)) ? 1 : 0;
-                        hw->multi[4] = ((buf[4] & 0x04)) ? 1 : 0;
-                        /* fallthrough */
-                    case 4:
-                        hw->multi[3] = ((buf[5] & 0x02)) ? 1 : 0;
-                        hw->multi[2] = ((buf[4] & 0x02)) ? 1 : 0;
-                        /* fallthrough */
-                    case 2:
-                        hw->multi[1] = ((buf[5] & 0x01)) ? 1 : 0;
-                        hw->multi[0] = ((buf[4] & 0x01)) ? 1 : 0;
-                    }
-                }
-            }
-        }
-    }
-    else {                      /* old proto... */
-        PS2DBG("using old protocol\n");
-        hw->x = (((buf[1] & 0x1F) << 8) | buf[2]);
-        hw->y = (((buf[4] & 0x1F) << 8) | buf[5]);
+/*
+ * Pick the packet decoder and fill in the tables it uses. Must be called
+ * whenever the model ID or the capabilities change.
+ */
+void
+ps2_setup_decoder(struct PS2SynapticsHwInfo *synhw)
+{
+    int w;
 
-        hw->z = (((buf[0] & 0x30) << 2) | (buf[3] & 0x3F));
-        w = (((buf[1] & 0x80) >> 4) | ((buf[0] & 0x04) >> 1));
+    if (!SYN_MODEL_NEWABS(synhw))
+        synhw->decode = ps2_decode_oldabs;
+    else if (SYN_CAP_EXTENDED(synhw))
+        synhw->decode = ps2_decode_newabs_ext;
+    else
+        synhw->decode = ps2_decode_newabs;
 
-        hw->left = (buf[0] & 0x01) ? 1 : 0;
-        hw->right = (buf[0] & 0x02) ? 1 : 0;
+    if (SYN_CAP_EXTENDED(synhw)) {
+        synhw->middle_mask = SYN_CAP_MIDDLE_BUTTON(synhw) ? 0x01 : 0x00;
+        synhw->four_button_mask = SYN_CAP_FOUR_BUTTON(synhw) ? 0x01 : 0x00;
+        synhw->multi_mask =
+            ps2_multi_button_mask[SYN_CAP_MULTI_BUTTON_NO(synhw)];
     }
+    else
+        synhw->middle_mask = synhw->four_button_mask = synhw->multi_mask = 0;
 
-    hw->y = YMAX_NOMINAL + YMIN_NOMINAL - hw->y;
-
-    if (hw->z >= para->finger_high) {
+    for (w = 0; w < 16; w++) {
         int w_ok = 0;
+        int val = w;
 
         /*
          * Use capability bits to decide if the w value is valid.
@@ -633,24 +1039,66 @@ PS2ReadHwStateProto(InputInfoPtr pInfo,
             }
         }
         if (!w_ok)
-            w = 5;
+            val = 5;
 
-        switch (w) {
+        switch (val) {
         case 0:
-            hw->numFingers = 2;
-            hw->fingerWidth = 5;
+            synhw->w_fingers[w] = 2;
+            synhw->w_width[w] = 5;
             break;
         case 1:
-            hw->numFingers = 3;
-            hw->fingerWidth = 5;
+            synhw->w_fingers[w] = 3;
+            synhw->w_width[w] = 5;
             break;
         default:
-            hw->numFingers = 1;
-            hw->fingerWidth = w;
+            synhw->w_fingers[w] = 1;
+            synhw->w_width[w] = val;
             break;
         }
     }
-    hw->millis = GetTimeInMillis();
+}
+
+Bool
+PS2ReadHwStateProto(InputInfoPtr pInfo,
+                    struct SynapticsProtocolOperations *proto_ops,
+                    struct CommData *comm, struct SynapticsHwState *hwRet)
+{
+    unsigned char *buf = comm->protoBuf;
+    struct SynapticsHwState *hw = comm->hwState;
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+    SynapticsParameters *para = &priv->synpara;
+    struct PS2SynapticsHwInfo *synhw;
+    int w, i;
+
+    synhw = (struct PS2SynapticsHwInfo *) priv->proto_data;
+    if (!synhw) {
+        LogMessageVerbSigSafe(X_ERROR, 0,
+                              "PS2ReadHwState, synhw is NULL. This is a bug.\n");
+        return FALSE;
+    }
+
+    if (!ps2_synaptics_get_packet(pInfo, synhw, proto_ops, comm))
+        return FALSE;
+
+    /* Identification failed, the packet format is unknown */
+    if (!synhw->decode)
+        return FALSE;
+
+    /* Handle normal packets */
+    hw->x = hw->y = hw->z = hw->numFingers = hw->fingerWidth = 0;
+    hw->left = hw->right = hw->up = hw->down = hw->middle = FALSE;
+    for (i = 0; i < 8; i++)
+        hw->multi[i] = FALSE;
+
+    synhw->decode(synhw, buf, hw, &w);
+
+    hw->y = YMAX_NOMINAL + YMIN_NOMINAL - hw->y;
+
+    if (hw->z >= para->finger_high) {
+        hw->numFingers = synhw->w_fingers[w];
+        hw->fingerWidth = synhw->w_width[w];
+    }
+    SynapticsSetHwTime(hw, SynapticsGetTimeInMicros());
     SynapticsCopyHwState(hwRet, hw);
     return TRUE;
 }
@@ -668,5 +1116,7 @@ struct SynapticsProtocolOperations psaux_proto_operations = {
     PS2QueryHardware,
     PS2ReadHwState,
     NULL,
-    NULL
+    NULL,
+    PS2SetReportRate,
+    FALSE
 };
@@ -96,14 +96,65 @@
 
 typedef unsigned char byte;
 
+struct PS2SynapticsHwInfo;
+
+typedef void (*PS2DecodeProc) (const struct PS2SynapticsHwInfo *synhw,
+                               const unsigned char *buf,
+                               struct SynapticsHwState *hw, int *w);
+
+enum PS2RecoveryState {
+    PS2_RECOVERY_IDLE,          /* Normal packet stream */
+    PS2_RECOVERY_CHECK_RESET,   /* Got 0xAA 0x00, wait if more data follows */
+    PS2_RECOVERY_RUNNING,       /* Reinitializing the touchpad */
+    PS2_RECOVERY_FAILED,        /* Gave up until the device is switched on again */
+};
+
+#define PS2_RECOVERY_SCRIPT_MAX 12
+
+/*
+ * Reset and reinitialization of the touchpad after it reset itself or
+ * the packet stream could not be synchronized, and report rate changes.
+ * Runs from the input handler and a timer, one command byte at a time, so
+ * that it never blocks the server.
+ */
+struct PS2Recovery {
+    enum PS2RecoveryState state;
+    int stage;                  /* Current step, PS2_STAGE_* */
+    byte script[PS2_RECOVERY_SCRIPT_MAX];       /* Commands of this step */
+    int script_len;
+    int pos;                    /* Number of commands sent */
+    Bool want_ack;              /* Waiting for the ACK of the last command */
+    int want_reply;             /* Answer bytes after the last ACK */
+    byte reply[3];
+    int nreply;
+    int attempts;               /* Failed attempts so far */
+    Bool mode_only;             /* Only rewrite the mode byte */
+    struct SynapticsProtocolOperations *proto_ops;
+    OsTimerPtr timer;           /* Timeout of the current step */
+};
+
 struct PS2SynapticsHwInfo {
     unsigned int model_id;      /* Model-ID */
     unsigned int capabilities;  /* Capabilities */
     unsigned int ext_cap;       /* Extended Capabilities */
     unsigned int identity;      /* Identification */
+
+    /* Set up by ps2_setup_decoder() from the values above */
+    PS2DecodeProc decode;       /* Packet decoder for this touchpad */
+    unsigned char middle_mask;  /* Middle button bit, 0 if none */
+    unsigned char four_button_mask;     /* Up/down button bit, 0 if none */
+    unsigned char multi_mask;   /* Multi button bits in bytes 4 and 5 */
+    unsigned char w_fingers[16];        /* Number of fingers for each W */
+    unsigned char w_width[16];  /* Finger width for each W */
+    Bool low_rate;              /* Run at 40 instead of 80 packets/s */
+
+    struct PS2Recovery recovery;
 };
 
+Bool ps2_getbyte(int fd, byte * b);
 Bool ps2_putbyte(int fd, byte b);
+void ps2_setup_decoder(struct PS2SynapticsHwInfo *synhw);
+void ps2_recovery_cancel(struct PS2SynapticsHwInfo *synhw);
 void ps2_print_ident(InputInfoPtr pInfo,
                      const struct PS2SynapticsHwInfo *synhw);
 Bool PS2ReadHwStateProto(InputInfoPtr pInfo,
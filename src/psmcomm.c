@@ -108,7 +108,6 @@ static void
 convert_hw_info(const synapticshw_t * psm_ident,
                 struct PS2SynapticsHwInfo *synhw)
 {
-    memset(synhw, 0, sizeof(*synhw));
     synhw->model_id = ((psm_ident->infoRot180 << 23) |
                        (psm_ident->infoPortrait << 22) |
                        (psm_ident->infoSensor << 16) |
@@ -128,6 +127,17 @@ convert_hw_info(const synapticshw_t * psm_ident,
                        (0x47 << 8) | (psm_ident->infoMinor << 16));
 }
 
+static Bool
+PSMDeviceOffHook(InputInfoPtr pInfo)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+
+    if (priv->proto_data)
+        ps2_recovery_cancel(priv->proto_data);
+
+    return TRUE;
+}
+
 static Bool
 PSMQueryHardware(InputInfoPtr pInfo)
 {
@@ -141,6 +151,10 @@ PSMQueryHardware(InputInfoPtr pInfo)
         priv->proto_data = calloc(1, sizeof(struct PS2SynapticsHwInfo));
     synhw = (struct PS2SynapticsHwInfo *) priv->proto_data;
 
+    /* allocate now so we don't allocate in the signal handler */
+    if (!synhw->recovery.timer)
+        synhw->recovery.timer = TimerSet(NULL, 0, 0, NULL, NULL);
+
     /* is the synaptics touchpad active? */
     if (!PSMQueryIsSynaptics(pInfo))
         return FALSE;
@@ -151,6 +165,7 @@ PSMQueryHardware(InputInfoPtr pInfo)
         return FALSE;
 
     convert_hw_info(&psm_ident, synhw);
+    ps2_setup_decoder(synhw);
 
     ps2_print_ident(pInfo, synhw);
 
@@ -166,9 +181,11 @@ PSMReadHwState(InputInfoPtr pInfo,
 
 struct SynapticsProtocolOperations psm_proto_operations = {
     NULL,
-    NULL,
+    PSMDeviceOffHook,
     PSMQueryHardware,
     PSMReadHwState,
     NULL,
-    NULL
+    NULL,
+    NULL,
+    FALSE
 };
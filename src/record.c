@@ -0,0 +1,500 @@
+/*
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of Red Hat
+ * not be used in advertising or publicity pertaining to distribution
+ * of the software without specific, written prior permission.  Red
+ * Hat makes no representations about the suitability of this software
+ * for any purpose.  It is provided "as is" without express or implied
+ * warranty.
+ *
+ * THE AUTHORS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Recording of the raw device input and replay of such recordings.
+ *
+ * The input path only appends to a preallocated ring, a timer writes the
+ * ring to the log file from the main loop. The replay reads the whole log
+ * into memory and hands out its entries when they are due, the protocol
+ * code reads them instead of the device.
+ *
+ * Log format: an 8 byte header ("SYNREC", version, 0) followed by
+ * entries. Every entry starts with a tag byte. Times are in microseconds,
+ * stored as the zigzag varint difference to the previous entry.
+ *   REC_TAG_BYTE:      time, raw byte
+ *   REC_TAG_BYTE_SAME: raw byte, same time as the previous entry
+ *   REC_TAG_EVENT:     time, type, code, value (varints, value zigzag)
+ * Every start of a recording appends a new header, the times start over
+ * from 0 after it.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <xorg-server.h>
+#include <xf86.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "synapticsstr.h"
+
+#define REC_MAGIC		"SYNREC"
+#define REC_VERSION		1
+#define REC_HEADER_SIZE		8
+
+#define REC_TAG_BYTE		0x01
+#define REC_TAG_BYTE_SAME	0x02
+#define REC_TAG_EVENT		0x03
+
+#define REC_RING_SIZE		(64 * 1024)     /* Must be a power of two */
+#define REC_ENTRY_MAX		32
+#define REC_FLUSH_INTERVAL	250     /* ms */
+
+struct SynapticsRecorder {
+    int fd;
+    unsigned char *ring;        /* Entries not written yet */
+    unsigned int head;          /* Next byte to write, free running */
+    unsigned int tail;          /* Next byte to fill, free running */
+    unsigned char *flush_buf;   /* Copy of the ring for writing */
+    int64_t last_time;          /* Time of the last entry in us */
+    unsigned int dropped;       /* Entries lost because the ring was full */
+    OsTimerPtr timer;           /* Flushes the ring */
+};
+
+struct SynapticsReplayEntry {
+    int tag;
+    int64_t time;               /* us since the start of the recording */
+    unsigned char byte;
+    int type, code, value;
+};
+
+struct SynapticsReplay {
+    unsigned char *data;        /* The whole log */
+    size_t len;
+    size_t pos;                 /* Start of the entry after next */
+    Bool have_next;             /* FALSE at the end of the log */
+    Bool new_recording;         /* next is the first entry after a header */
+    struct SynapticsReplayEntry next;
+    int64_t offset;             /* Log time to server time in us */
+};
+
+static int64_t
+rec_now(void)
+{
+    return (int64_t) SynapticsGetTimeInMicros();
+}
+
+static int
+rec_put_varint(unsigned char *p, uint64_t v)
+{
+    int n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    p[n++] = v;
+    return n;
+}
+
+static uint64_t
+rec_zigzag(int64_t v)
+{
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static int64_t
+rec_unzigzag(uint64_t v)
+{
+    return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+/*
+ * Append an entry to the ring. Called from the input path, so this never
+ * blocks; if the writer can't keep up the entry is lost.
+ */
+static Bool
+rec_put(struct SynapticsRecorder *rec, const unsigned char *entry, int len)
+{
+    int i;
+
+    if (REC_RING_SIZE - (rec->tail - rec->head) < len) {
+        rec->dropped++;
+        return FALSE;
+    }
+
+    for (i = 0; i < len; i++)
+        rec->ring[(rec->tail + i) & (REC_RING_SIZE - 1)] = entry[i];
+    rec->tail += len;
+    return TRUE;
+}
+
+void
+SynapticsRecordByte(struct SynapticsRecorder *rec, unsigned char b)
+{
+    unsigned char entry[REC_ENTRY_MAX];
+    int64_t now = rec_now();
+    int n = 0;
+
+    if (now == rec->last_time)
+        entry[n++] = REC_TAG_BYTE_SAME;
+    else {
+        entry[n++] = REC_TAG_BYTE;
+        n += rec_put_varint(entry + n, rec_zigzag(now - rec->last_time));
+    }
+    entry[n++] = b;
+
+    if (rec_put(rec, entry, n))
+        rec->last_time = now;
+}
+
+void
+SynapticsRecordEvent(struct SynapticsRecorder *rec, const struct timeval *time,
+                     int type, int code, int value)
+{
+    unsigned char entry[REC_ENTRY_MAX];
+    int64_t t = (int64_t) time->tv_sec * 1000000 + time->tv_usec;
+    int n = 0;
+
+    entry[n++] = REC_TAG_EVENT;
+    n += rec_put_varint(entry + n, rec_zigzag(t - rec->last_time));
+    n += rec_put_varint(entry + n, type);
+    n += rec_put_varint(entry + n, code);
+    n += rec_put_varint(entry + n, rec_zigzag(value));
+
+    if (rec_put(rec, entry, n))
+        rec->last_time = t;
+}
+
+/*
+ * Write everything in the ring to the log. The ring is only locked while
+ * it is copied, not while the file is written.
+ */
+static void
+rec_flush(struct SynapticsRecorder *rec)
+{
+    unsigned int len, start, first;
+    unsigned int dropped;
+    int sigstate;
+
+    sigstate = xf86BlockSIGIO();
+    len = rec->tail - rec->head;
+    start = rec->head & (REC_RING_SIZE - 1);
+    first = REC_RING_SIZE - start;
+    if (first > len)
+        first = len;
+    memcpy(rec->flush_buf, rec->ring + start, first);
+    memcpy(rec->flush_buf + first, rec->ring, len - first);
+    rec->head += len;
+    dropped = rec->dropped;
+    rec->dropped = 0;
+    xf86UnblockSIGIO(sigstate);
+
+    if (len > 0 && write(rec->fd, rec->flush_buf, len) != (ssize_t) len)
+        xf86Msg(X_WARNING, "synaptics: writing the input log failed: %s\n",
+                strerror(errno));
+    if (dropped > 0)
+        xf86Msg(X_WARNING, "synaptics: input log overflow, %u entries lost\n",
+                dropped);
+}
+
+static CARD32
+rec_flush_timer(OsTimerPtr timer, CARD32 now, pointer arg)
+{
+    rec_flush(arg);
+    return REC_FLUSH_INTERVAL;
+}
+
+static void
+rec_free(struct SynapticsRecorder *rec)
+{
+    if (rec->timer) {
+        TimerFree(rec->timer);
+        rec_flush(rec);
+    }
+    if (rec->fd != -1)
+        close(rec->fd);
+    free(rec->ring);
+    free(rec->flush_buf);
+    free(rec);
+}
+
+static struct SynapticsRecorder *
+rec_new(const char *path)
+{
+    struct SynapticsRecorder *rec;
+    unsigned char header[REC_HEADER_SIZE] = REC_MAGIC;
+
+    rec = calloc(1, sizeof(*rec));
+    if (!rec)
+        return NULL;
+
+    rec->ring = malloc(REC_RING_SIZE);
+    rec->flush_buf = malloc(REC_RING_SIZE);
+    rec->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (!rec->ring || !rec->flush_buf || rec->fd == -1)
+        goto fail;
+
+    header[6] = REC_VERSION;
+    if (write(rec->fd, header, sizeof(header)) != sizeof(header))
+        goto fail;
+
+    rec->timer = TimerSet(NULL, 0, REC_FLUSH_INTERVAL, rec_flush_timer, rec);
+    if (!rec->timer)
+        goto fail;
+
+    return rec;
+
+ fail:
+    rec_free(rec);
+    return NULL;
+}
+
+/*
+ * Start or stop recording to the RecordFile.
+ * Returns FALSE if recording could not be started.
+ */
+Bool
+SynapticsSetRecording(InputInfoPtr pInfo, Bool on)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+    struct SynapticsRecorder *rec = priv->comm.recorder;
+    int sigstate;
+
+    if (on == (rec != NULL))
+        return TRUE;
+
+    if (on) {
+        if (!priv->record_file)
+            return FALSE;
+        rec = rec_new(priv->record_file);
+        if (!rec) {
+            xf86IDrvMsg(pInfo, X_ERROR, "cannot record input to %s: %s\n",
+                        priv->record_file, strerror(errno));
+            return FALSE;
+        }
+        xf86IDrvMsg(pInfo, X_INFO, "recording input to %s\n",
+                    priv->record_file);
+    }
+
+    sigstate = xf86BlockSIGIO();
+    priv->comm.recorder = on ? rec : NULL;
+    xf86UnblockSIGIO(sigstate);
+
+    if (!on)
+        rec_free(rec);
+
+    return TRUE;
+}
+
+static Bool
+rep_get_varint(struct SynapticsReplay *replay, uint64_t *v)
+{
+    int shift = 0;
+
+    *v = 0;
+    while (replay->pos < replay->len && shift < 64) {
+        unsigned char b = replay->data[replay->pos++];
+
+        *v |= (uint64_t) (b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return TRUE;
+        shift += 7;
+    }
+    return FALSE;
+}
+
+/*
+ * Decode the entry at pos into next. Headers are skipped and start a new
+ * recording.
+ */
+static void
+rep_advance(struct SynapticsReplay *replay)
+{
+    struct SynapticsReplayEntry *e = &replay->next;
+    uint64_t v, type, code, value;
+
+    replay->have_next = FALSE;
+
+    while (replay->pos + REC_HEADER_SIZE <= replay->len &&
+           memcmp(replay->data + replay->pos, REC_MAGIC,
+                  strlen(REC_MAGIC)) == 0) {
+        replay->pos += REC_HEADER_SIZE;
+        replay->new_recording = TRUE;
+        e->time = 0;
+    }
+
+    if (replay->pos >= replay->len)
+        return;
+
+    e->tag = replay->data[replay->pos++];
+    switch (e->tag) {
+    case REC_TAG_BYTE:
+        if (!rep_get_varint(replay, &v) || replay->pos >= replay->len)
+            return;
+        e->time += rec_unzigzag(v);
+        e->byte = replay->data[replay->pos++];
+        break;
+    case REC_TAG_BYTE_SAME:
+        if (replay->pos >= replay->len)
+            return;
+        e->byte = replay->data[replay->pos++];
+        break;
+    case REC_TAG_EVENT:
+        if (!rep_get_varint(replay, &v) || !rep_get_varint(replay, &type) ||
+            !rep_get_varint(replay, &code) || !rep_get_varint(replay, &value))
+            return;
+        e->time += rec_unzigzag(v);
+        e->type = type;
+        e->code = code;
+        e->value = rec_unzigzag(value);
+        break;
+    default:
+        xf86Msg(X_WARNING, "synaptics: corrupt input log at offset %lu\n",
+                (unsigned long) replay->pos - 1);
+        return;
+    }
+
+    /* Play recordings one after another, starting now */
+    if (replay->new_recording) {
+        replay->offset = rec_now() - e->time;
+        replay->new_recording = FALSE;
+    }
+
+    replay->have_next = TRUE;
+}
+
+static Bool
+rep_due(struct SynapticsReplay *replay)
+{
+    return replay->have_next &&
+        replay->next.time + replay->offset <= rec_now();
+}
+
+struct SynapticsReplay *
+SynapticsReplayOpen(const char *path)
+{
+    struct SynapticsReplay *replay;
+    struct stat st;
+    int fd;
+
+    replay = calloc(1, sizeof(*replay));
+    if (!replay)
+        return NULL;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_size < REC_HEADER_SIZE)
+        goto fail;
+
+    replay->len = st.st_size;
+    replay->data = malloc(replay->len);
+    if (!replay->data ||
+        read(fd, replay->data, replay->len) != (ssize_t) replay->len ||
+        memcmp(replay->data, REC_MAGIC, strlen(REC_MAGIC)) != 0 ||
+        replay->data[6] != REC_VERSION)
+        goto fail;
+
+    close(fd);
+    rep_advance(replay);
+    return replay;
+
+ fail:
+    if (fd != -1)
+        close(fd);
+    SynapticsReplayFree(replay);
+    return NULL;
+}
+
+void
+SynapticsReplayFree(struct SynapticsReplay *replay)
+{
+    if (!replay)
+        return;
+    free(replay->data);
+    free(replay);
+}
+
+/*
+ * Return the next byte if it is due, -1 otherwise. The device input is
+ * dropped while a log is replayed.
+ */
+int
+SynapticsReplayByte(struct CommData *comm)
+{
+    struct SynapticsReplay *replay = comm->replay;
+    int b;
+
+    while (rep_due(replay)) {
+        if (replay->next.tag == REC_TAG_EVENT) {
+            rep_advance(replay);
+            continue;
+        }
+        b = replay->next.byte;
+        rep_advance(replay);
+        return b;
+    }
+
+    while (XisbRead(comm->buffer) >= 0);
+
+    return -1;
+}
+
+/*
+ * Return the next event if it is due. Its time is moved to the time it
+ * is replayed at.
+ */
+Bool
+SynapticsReplayEvent(struct SynapticsReplay *replay, struct timeval *time,
+                     int *type, int *code, int *value)
+{
+    int64_t t;
+
+    while (rep_due(replay)) {
+        if (replay->next.tag != REC_TAG_EVENT) {
+            rep_advance(replay);
+            continue;
+        }
+        t = replay->next.time + replay->offset;
+        time->tv_sec = t / 1000000;
+        time->tv_usec = t % 1000000;
+        *type = replay->next.type;
+        *code = replay->next.code;
+        *value = replay->next.value;
+        rep_advance(replay);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * Milliseconds until the next entry is due, or -1 at the end of the log.
+ */
+int
+SynapticsReplayDelay(struct SynapticsReplay *replay)
+{
+    int64_t delay;
+
+    if (!replay->have_next)
+        return -1;
+
+    delay = replay->next.time + replay->offset - rec_now();
+    if (delay <= 0)
+        return 0;
+    return (delay + 999) / 1000;
+}
@@ -64,6 +64,7 @@
 #include <misc.h>
 #include <xf86.h>
 #include <math.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <xf86_OSproc.h>
 #include <xf86Xinput.h>
@@ -123,8 +124,7 @@ static int SynapticsPreInit(InputDriverPtr drv, InputInfoPtr pInfo, int flags);
 static void SynapticsUnInit(InputDriverPtr drv, InputInfoPtr pInfo, int flags);
 static Bool DeviceControl(DeviceIntPtr, int);
 static void ReadInput(InputInfoPtr);
-static int HandleState(InputInfoPtr, struct SynapticsHwState *, CARD32 now,
-                       Bool from_timer);
+static CARD32 replayTimerFunc(OsTimerPtr timer, CARD32 now, pointer arg);
 static int ControlProc(InputInfoPtr, xDeviceCtl *);
 static int SwitchMode(ClientPtr, DeviceIntPtr, int);
 static int DeviceInit(DeviceIntPtr);
@@ -138,9 +138,11 @@ static void ScaleCoordinates(SynapticsPrivate * priv,
                              struct SynapticsHwState *hw);
 static void CalculateScalingCoeffs(SynapticsPrivate * priv);
 #endif
+static void CalculateDeltaLimit(SynapticsPrivate * priv);
 static void SanitizeDimensions(InputInfoPtr pInfo);
 
 void InitDeviceProperties(InputInfoPtr pInfo);
+void SynapticsPublishCalibration(InputInfoPtr pInfo);
 int SetProperty(DeviceIntPtr dev, Atom property, XIPropertyValuePtr prop,
                 BOOL checkonly);
 
@@ -551,6 +553,177 @@ set_secondary_softbutton_areas_option(InputInfoPtr pInfo)
     set_softbutton_areas_option(pInfo, "SecondarySoftButtonAreas", TOP_BUTTON_AREA);
 }
 
+Bool
+SynapticsIsAccelPointsValid(const float *points, int num_points)
+{
+    int i;
+
+    if (num_points > ACCEL_MAX_POINTS || num_points == 1)
+        return FALSE;
+
+    for (i = 0; i < num_points; i++) {
+        /* Velocities must be strictly increasing */
+        if (points[2 * i] < 0 || points[2 * i + 1] < 0 ||
+            (i > 0 && points[2 * i] <= points[2 * (i - 1)]))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+set_accel_points_option(InputInfoPtr pInfo)
+{
+    SynapticsPrivate *priv = pInfo->private;
+    SynapticsParameters *pars = &priv->synpara;
+    float points[2 * ACCEL_MAX_POINTS];
+    char *option_string;
+    char *next_num;
+    char *end_str;
+    int i;
+
+    option_string = xf86SetStrOption(pInfo->options, "AccelPoints", NULL);
+    if (!option_string)
+        return;
+
+    next_num = option_string;
+
+    for (i = 0; i < 2 * ACCEL_MAX_POINTS; i++) {
+        while (*next_num == ' ')
+            next_num++;
+        if (*next_num == '\0')
+            break;
+
+        points[i] = strtod(next_num, &end_str);
+        if (next_num == end_str)
+            goto fail;
+        next_num = end_str;
+    }
+
+    while (*next_num == ' ')
+        next_num++;
+
+    if (i % 2 || *next_num != '\0' ||
+        !SynapticsIsAccelPointsValid(points, i / 2))
+        goto fail;
+
+    memcpy(pars->accel_points, points, i * sizeof(float));
+    pars->accel_num_points = i / 2;
+    free(option_string);
+
+    return;
+
+ fail:
+    xf86IDrvMsg(pInfo, X_ERROR,
+                "invalid AccelPoints value '%s', keeping defaults\n",
+                option_string);
+    free(option_string);
+}
+
+Bool
+SynapticsIsPressureCurveValid(const int *curve)
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+        if (curve[i] < 0 || curve[i] > 100)
+            return FALSE;
+
+    return TRUE;
+}
+
+static void
+set_pressure_curve_option(InputInfoPtr pInfo)
+{
+    SynapticsPrivate *priv = pInfo->private;
+    SynapticsParameters *pars = &priv->synpara;
+    int curve[4];
+    char *option_string;
+
+    /* Linear by default */
+    pars->pressure_curve[0] = 0;
+    pars->pressure_curve[1] = 0;
+    pars->pressure_curve[2] = 100;
+    pars->pressure_curve[3] = 100;
+
+    option_string = xf86SetStrOption(pInfo->options, "PressureCurve", NULL);
+    if (!option_string)
+        return;
+
+    if (sscanf(option_string, "%d %d %d %d",
+               &curve[0], &curve[1], &curve[2], &curve[3]) != 4 ||
+        !SynapticsIsPressureCurveValid(curve))
+        xf86IDrvMsg(pInfo, X_ERROR,
+                    "invalid PressureCurve value '%s', using a linear curve\n",
+                    option_string);
+    else
+        memcpy(pars->pressure_curve, curve, sizeof(curve));
+
+    free(option_string);
+}
+
+Bool
+SynapticsIsCalibrationValid(const int *extents)
+{
+    if (!extents[0] && !extents[1] && !extents[2] && !extents[3])
+        return TRUE;
+
+    return extents[0] < extents[1] && extents[2] < extents[3];
+}
+
+static void
+set_calibration_option(InputInfoPtr pInfo)
+{
+    SynapticsPrivate *priv = pInfo->private;
+    SynapticsParameters *pars = &priv->synpara;
+    int values[4 + CALIB_GRID_VALUES];
+    char *option_string;
+    char *next_num;
+    char *end_str;
+    int i;
+
+    option_string = xf86SetStrOption(pInfo->options, "Calibration", NULL);
+    if (!option_string)
+        return;
+
+    next_num = option_string;
+
+    for (i = 0; i < 4 + CALIB_GRID_VALUES; i++) {
+        long int value;
+
+        while (*next_num == ' ')
+            next_num++;
+        if (*next_num == '\0')
+            break;
+
+        value = strtol(next_num, &end_str, 0);
+        if (next_num == end_str || value > INT_MAX || value < -INT_MAX)
+            goto fail;
+        values[i] = value;
+        next_num = end_str;
+    }
+
+    while (*next_num == ' ')
+        next_num++;
+
+    if ((i != 4 && i != 4 + CALIB_GRID_VALUES) || *next_num != '\0' ||
+        !SynapticsIsCalibrationValid(values))
+        goto fail;
+
+    memcpy(pars->calib_extents, values, 4 * sizeof(int));
+    if (i > 4)
+        memcpy(pars->calib_grid, values + 4, CALIB_GRID_VALUES * sizeof(int));
+    free(option_string);
+
+    return;
+
+ fail:
+    xf86IDrvMsg(pInfo, X_ERROR,
+                "invalid Calibration value '%s', using the kernel ranges\n",
+                option_string);
+    free(option_string);
+}
+
 static void
 set_default_parameters(InputInfoPtr pInfo)
 {
@@ -662,6 +835,17 @@ set_default_parameters(InputInfoPtr pInfo)
     pars->area_right_edge =
         set_percent_option(opts, "AreaRightEdge", width, priv->minx, 0);
 
+    pars->abs_zone_top_edge =
+        set_percent_option(opts, "AbsoluteZoneTopEdge", height, priv->miny, 0);
+    pars->abs_zone_bottom_edge =
+        set_percent_option(opts, "AbsoluteZoneBottomEdge", height, priv->miny,
+                           0);
+    pars->abs_zone_left_edge =
+        set_percent_option(opts, "AbsoluteZoneLeftEdge", width, priv->minx, 0);
+    pars->abs_zone_right_edge =
+        set_percent_option(opts, "AbsoluteZoneRightEdge", width, priv->minx,
+                           0);
+
     pars->hyst_x =
         set_percent_option(opts, "HorizHysteresis", width, 0, horizHyst);
     pars->hyst_y =
@@ -735,6 +919,14 @@ set_default_parameters(InputInfoPtr pInfo)
     pars->circular_trigger = xf86SetIntOption(opts, "CircScrollTrigger", 0);
     pars->circular_pad = xf86SetBoolOption(opts, "CircularPad", FALSE);
     pars->palm_detect = xf86SetBoolOption(opts, "PalmDetect", FALSE);
+    pars->absolute_hover = xf86SetBoolOption(opts, "AbsoluteHover", FALSE);
+    pars->report_rate = xf86SetIntOption(opts, "ReportRate", RATE_HIGH);
+    if (pars->report_rate < 0 || pars->report_rate > RATE_MAX) {
+        xf86IDrvMsg(pInfo, X_ERROR,
+                    "invalid ReportRate %d, using the high rate\n",
+                    pars->report_rate);
+        pars->report_rate = RATE_HIGH;
+    }
     pars->palm_min_width = xf86SetIntOption(opts, "PalmMinWidth", palmMinWidth);
     pars->palm_min_z = xf86SetIntOption(opts, "PalmMinZ", palmMinZ);
     pars->single_tap_timeout = xf86SetIntOption(opts, "SingleTapTimeout", 180);
@@ -746,6 +938,18 @@ set_default_parameters(InputInfoPtr pInfo)
     pars->min_speed = xf86SetRealOption(opts, "MinSpeed", 0.4);
     pars->max_speed = xf86SetRealOption(opts, "MaxSpeed", 0.7);
     pars->accl = xf86SetRealOption(opts, "AccelFactor", accelFactor);
+    pars->accel_profile = xf86SetIntOption(opts, "AccelProfile", ACCEL_LINEAR);
+    if (pars->accel_profile < 0 || pars->accel_profile > ACCEL_MAX_PROFILE) {
+        xf86IDrvMsg(pInfo, X_ERROR,
+                    "invalid AccelProfile %d, using the linear profile\n",
+                    pars->accel_profile);
+        pars->accel_profile = ACCEL_LINEAR;
+    }
+    set_accel_points_option(pInfo);
+    set_pressure_curve_option(pInfo);
+    pars->calib_learn = xf86SetBoolOption(opts, "CalibrationLearning", FALSE);
+    pars->calib_fit_grid = xf86SetBoolOption(opts, "CalibrationGrid", FALSE);
+    set_calibration_option(pInfo);
     pars->scroll_dist_circ = xf86SetRealOption(opts, "CircScrollDelta", 0.1);
     pars->coasting_speed = xf86SetRealOption(opts, "CoastingSpeed", 20.0);
     pars->coasting_friction = xf86SetRealOption(opts, "CoastingFriction", 50);
@@ -765,6 +969,33 @@ set_default_parameters(InputInfoPtr pInfo)
 
     pars->tap_and_drag_gesture =
         xf86SetBoolOption(opts, "TapAndDragGesture", TRUE);
+    pars->record = (priv->record_file != NULL);
+    pars->gesture_action[SWIPE3_LEFT] =
+        xf86SetIntOption(opts, "ThreeFingerSwipeLeft", 0);
+    pars->gesture_action[SWIPE3_RIGHT] =
+        xf86SetIntOption(opts, "ThreeFingerSwipeRight", 0);
+    pars->gesture_action[SWIPE3_UP] =
+        xf86SetIntOption(opts, "ThreeFingerSwipeUp", 0);
+    pars->gesture_action[SWIPE3_DOWN] =
+        xf86SetIntOption(opts, "ThreeFingerSwipeDown", 0);
+    pars->gesture_action[SWIPE4_LEFT] =
+        xf86SetIntOption(opts, "FourFingerSwipeLeft", 0);
+    pars->gesture_action[SWIPE4_RIGHT] =
+        xf86SetIntOption(opts, "FourFingerSwipeRight", 0);
+    pars->gesture_action[SWIPE4_UP] =
+        xf86SetIntOption(opts, "FourFingerSwipeUp", 0);
+    pars->gesture_action[SWIPE4_DOWN] =
+        xf86SetIntOption(opts, "FourFingerSwipeDown", 0);
+    pars->gesture_action[PINCH_IN] = xf86SetIntOption(opts, "PinchIn", 0);
+    pars->gesture_action[PINCH_OUT] = xf86SetIntOption(opts, "PinchOut", 0);
+    pars->gesture_action[ROTATE_LEFT] =
+        xf86SetIntOption(opts, "RotateLeft", 0);
+    pars->gesture_action[ROTATE_RIGHT] =
+        xf86SetIntOption(opts, "RotateRight", 0);
+    pars->gesture_swipe_dist =
+        xf86SetIntOption(opts, "SwipeDistance", diag * 0.15);
+    pars->gesture_pinch_ratio = xf86SetIntOption(opts, "PinchRatio", 30);
+    pars->gesture_rotate_angle = xf86SetIntOption(opts, "RotateAngle", 25);
     pars->resolution_horiz =
         xf86SetIntOption(opts, "HorizResolution", horizResolution);
     pars->resolution_vert =
@@ -812,6 +1043,150 @@ set_default_parameters(InputInfoPtr pInfo)
         set_secondary_softbutton_areas_option(pInfo);
 }
 
+/* Speed factor of the piecewise profile at velocity v */
+static double
+accel_piecewise(const float *points, int num_points, double v)
+{
+    int i;
+
+    if (v <= points[0])
+        return points[1];
+
+    for (i = 1; i < num_points; i++) {
+        double v0 = points[2 * (i - 1)], f0 = points[2 * (i - 1) + 1];
+        double v1 = points[2 * i], f1 = points[2 * i + 1];
+
+        if (v <= v1)
+            return f0 + (v - v0) * (f1 - f0) / (v1 - v0);
+    }
+
+    return points[2 * num_points - 1];
+}
+
+/*
+ * Precompute the acceleration profile into priv->accel.table. Must be called
+ * whenever the speed or profile parameters change. The table spans the
+ * velocities where the profile bends; beyond its end the profile continues
+ * as a straight line with slope priv->accel.tail.
+ */
+void
+SynapticsUpdateAccelProfile(SynapticsPrivate * priv)
+{
+    SynapticsParameters *para = &priv->synpara;
+    double min = para->min_speed, max = MAX(para->max_speed, para->min_speed);
+    double accl = para->accl > 0 ? para->accl : 1e-6;
+    float points[2 * ACCEL_MAX_POINTS];
+    int num_points = para->accel_num_points;
+    double vmax, mid = 0, k = 0;
+    int i;
+
+    switch (para->accel_profile) {
+    case ACCEL_PIECEWISE:
+        /* Without points, follow the linear profile */
+        if (num_points < 2) {
+            points[0] = min / accl;
+            points[1] = min;
+            points[2] = max / accl;
+            points[3] = max;
+            num_points = 2;
+        }
+        else
+            memcpy(points, para->accel_points, 2 * num_points * sizeof(float));
+        vmax = points[2 * num_points - 2];
+        priv->accel.tail = 0;
+        break;
+    case ACCEL_SIGMOID:
+        /* Centered where the linear profile is halfway between MinSpeed and
+         * MaxSpeed, with the same slope there */
+        mid = (min + max) / 2 / accl;
+        k = (max > min) ? 4 * accl / (max - min) : 1;
+        vmax = mid + 6 / k;
+        priv->accel.tail = 0;
+        break;
+    default:
+        vmax = max / accl;
+        priv->accel.tail = accl;
+        break;
+    }
+
+    if (vmax <= 0)
+        vmax = 1;
+    priv->accel.step_inv = (ACCEL_TABLE_SIZE - 1) / vmax;
+
+    for (i = 0; i < ACCEL_TABLE_SIZE; i++) {
+        double v = i * vmax / (ACCEL_TABLE_SIZE - 1);
+        double f;
+
+        switch (para->accel_profile) {
+        case ACCEL_PIECEWISE:
+            f = accel_piecewise(points, num_points, v);
+            break;
+        case ACCEL_SIGMOID:
+            f = min + (max - min) / (1 + exp(-k * (v - mid)));
+            break;
+        default:
+            f = MAX(v * accl, min);
+            break;
+        }
+        priv->accel.table[i] = f;
+    }
+}
+
+/*
+ * Precompute the pressure curve into priv->pressure.table. The curve is a
+ * cubic Bezier from (0, 0) to (1, 1) with the two inner control points from
+ * the PressureCurve parameter, sampled finer than the table so every entry
+ * is hit.
+ */
+void
+SynapticsUpdatePressureCurve(SynapticsPrivate * priv)
+{
+    const int *curve = priv->synpara.pressure_curve;
+    double x1 = curve[0] / 100.0, y1 = curve[1] / 100.0;
+    double x2 = curve[2] / 100.0, y2 = curve[3] / 100.0;
+    int steps = 4 * PRESSURE_TABLE_SIZE;
+    int i;
+
+    for (i = 0; i < PRESSURE_TABLE_SIZE; i++)
+        priv->pressure.table[i] = -1;
+
+    for (i = 0; i <= steps; i++) {
+        double t = (double) i / steps, u = 1 - t;
+        double x = 3 * u * u * t * x1 + 3 * u * t * t * x2 + t * t * t;
+        double y = 3 * u * u * t * y1 + 3 * u * t * t * y2 + t * t * t;
+
+        priv->pressure.table[lround(x * (PRESSURE_TABLE_SIZE - 1))] =
+            lround(y * PRESSURE_AXIS_MAX);
+    }
+
+    /* The curve's x is monotonic, fill any entry the sampling skipped */
+    for (i = 1; i < PRESSURE_TABLE_SIZE; i++)
+        if (priv->pressure.table[i] < 0)
+            priv->pressure.table[i] = priv->pressure.table[i - 1];
+}
+
+/* Pressure factor for the motion of this frame, read by the profile */
+static void
+update_accel_pressure(SynapticsPrivate * priv,
+                      const struct SynapticsHwState *hw)
+{
+    SynapticsParameters *para = &priv->synpara;
+    int minZ = para->press_motion_min_z;
+    int maxZ = para->press_motion_max_z;
+    double minFctr = para->press_motion_min_factor;
+    double maxFctr = para->press_motion_max_factor;
+
+    if (priv->moving_state != MS_TOUCHPAD_RELATIVE)
+        priv->accel_pressure = 1.0;
+    else if (hw->z <= minZ)
+        priv->accel_pressure = minFctr;
+    else if (hw->z >= maxZ)
+        priv->accel_pressure = maxFctr;
+    else
+        priv->accel_pressure =
+            minFctr + (hw->z - minZ) * (maxFctr - minFctr) / (maxZ - minZ);
+}
+
 static double
 SynapticsAccelerationProfile(DeviceIntPtr dev,
                              DeviceVelocityPtr vel,
@@ -820,8 +1195,8 @@ SynapticsAccelerationProfile(DeviceIntPtr dev,
     InputInfoPtr pInfo = dev->public.devicePrivate;
     SynapticsPrivate *priv = (SynapticsPrivate *) (pInfo->private);
     SynapticsParameters *para = &priv->synpara;
-
-    double accelfct;
+    double accelfct, pos;
+    int i;
 
     /*
      * synaptics accel was originally base on device coordinate based
@@ -829,8 +1204,17 @@ SynapticsAccelerationProfile(DeviceIntPtr dev,
      */
     velocity /= vel->const_acceleration;
 
-    /* speed up linear with finger velocity */
-    accelfct = velocity * para->accl;
+    /* look up the speed factor for the finger velocity */
+    pos = velocity * priv->accel.step_inv;
+    if (pos >= ACCEL_TABLE_SIZE - 1)
+        accelfct = priv->accel.table[ACCEL_TABLE_SIZE - 1] +
+            (pos - (ACCEL_TABLE_SIZE - 1)) / priv->accel.step_inv *
+            priv->accel.tail;
+    else {
+        i = pos;
+        accelfct = priv->accel.table[i] +
+            (pos - i) * (priv->accel.table[i + 1] - priv->accel.table[i]);
+    }
 
     /* clip acceleration factor */
     if (accelfct > para->max_speed * acc)
@@ -839,37 +1223,26 @@ SynapticsAccelerationProfile(DeviceIntPtr dev,
         accelfct = para->min_speed;
 
     /* modify speed according to pressure */
-    if (priv->moving_state == MS_TOUCHPAD_RELATIVE) {
-        int minZ = para->press_motion_min_z;
-        int maxZ = para->press_motion_max_z;
-        double minFctr = para->press_motion_min_factor;
-        double maxFctr = para->press_motion_max_factor;
-
-        if (priv->hwState->z <= minZ) {
-            accelfct *= minFctr;
-        }
-        else if (priv->hwState->z >= maxZ) {
-            accelfct *= maxFctr;
-        }
-        else {
-            accelfct *=
-                minFctr + (priv->hwState->z - minZ) * (maxFctr -
-                                                       minFctr) / (maxZ - minZ);
-        }
-    }
-
-    return accelfct;
+    return accelfct * priv->accel_pressure;
 }
 
+/* Fails to compile if the per-frame state outgrows its cache lines */
+typedef char synaptics_hot_lines_check[offsetof(SynapticsPrivate, minx) <=
+                                       SYNAPTICS_HOT_LINES *
+                                       SYNAPTICS_CACHE_LINE ? 1 : -1];
+
 static int
 SynapticsPreInit(InputDriverPtr drv, InputInfoPtr pInfo, int flags)
 {
     SynapticsPrivate *priv;
+    void *mem;
 
-    /* allocate memory for SynapticsPrivateRec */
-    priv = calloc(1, sizeof(SynapticsPrivate));
-    if (!priv)
+    /* allocate memory for SynapticsPrivateRec, the per-frame state starts
+     * on a cache line */
+    if (posix_memalign(&mem, SYNAPTICS_CACHE_LINE, sizeof(SynapticsPrivate)))
         return BadAlloc;
+    priv = mem;
+    memset(priv, 0, sizeof(SynapticsPrivate));
 
     pInfo->type_name = XI_TOUCHPAD;
     pInfo->device_control = DeviceControl;
@@ -893,6 +1266,8 @@ SynapticsPreInit(InputDriverPtr drv, InputInfoPtr pInfo, int flags)
     }
 
     priv->device = xf86FindOptionValue(pInfo->options, "Device");
+    priv->record_file = xf86SetStrOption(pInfo->options, "RecordFile", NULL);
+    priv->replay_file = xf86SetStrOption(pInfo->options, "ReplayFile", NULL);
 
     /* open the touchpad device */
     pInfo->fd = xf86OpenSerial(pInfo->options);
@@ -921,7 +1296,7 @@ SynapticsPreInit(InputDriverPtr drv, InputInfoPtr pInfo, int flags)
 #ifndef NO_DRIVER_SCALING
     CalculateScalingCoeffs(priv);
 #endif
-
+    CalculateDeltaLimit(priv);
 
     priv->comm.buffer = XisbNew(pInfo->fd, INPUT_BUFFER_SIZE);
 
@@ -948,6 +1323,8 @@ SynapticsPreInit(InputDriverPtr drv, InputInfoPtr pInfo, int flags)
         XisbFree(priv->comm.buffer);
     free(priv->proto_data);
     free(priv->timer);
+    free(priv->record_file);
+    free(priv->replay_file);
     free(priv);
     pInfo->private = NULL;
     return BadAlloc;
@@ -965,10 +1342,20 @@ SynapticsUnInit(InputDriverPtr drv, InputInfoPtr pInfo, int flags)
         free(priv->timer);
     if (priv && priv->proto_data)
         free(priv->proto_data);
-    if (priv && priv->scroll_events_mask)
-        valuator_mask_free(&priv->scroll_events_mask);
+    if (priv && priv->events_mask)
+        valuator_mask_free(&priv->events_mask);
     if (priv && priv->open_slots)
         free(priv->open_slots);
+    if (priv && priv->slot_index)
+        free(priv->slot_index);
+    if (priv && priv->touch_class)
+        free(priv->touch_class);
+    if (priv && priv->gesture_touch)
+        free(priv->gesture_touch);
+    if (priv) {
+        free(priv->record_file);
+        free(priv->replay_file);
+    }
     free(pInfo->private);
     pInfo->private = NULL;
     xf86DeleteInput(pInfo, 0);
@@ -1036,6 +1423,20 @@ DeviceOn(DeviceIntPtr dev)
     if (!QueryHardware(pInfo))
         goto error;
 
+    SynapticsSetRecording(pInfo, priv->synpara.record);
+
+    if (priv->replay_file) {
+        priv->comm.replay = SynapticsReplayOpen(priv->replay_file);
+        if (priv->comm.replay) {
+            xf86IDrvMsg(pInfo, X_INFO, "replaying %s\n", priv->replay_file);
+            priv->replay_timer = TimerSet(priv->replay_timer, 0, 1,
+                                          replayTimerFunc, pInfo);
+        }
+        else
+            xf86IDrvMsg(pInfo, X_ERROR, "cannot replay %s\n",
+                        priv->replay_file);
+    }
+
     xf86AddEnabledDevice(pInfo);
     dev->public.on = TRUE;
 
@@ -1068,6 +1469,9 @@ SynapticsReset(SynapticsPrivate * priv)
     priv->last_motion_millis = 0;
     priv->clickpad_click_millis = 0;
     priv->last_button_area = NO_BUTTON_AREA;
+    priv->zone_touch = FALSE;
+    memset(&priv->rate, 0, sizeof(priv->rate));
+    priv->rate.high = TRUE;
     priv->tap_state = TS_START;
     priv->tap_button = 0;
     priv->tap_button_state = TBS_BUTTON_UP;
@@ -1084,9 +1488,17 @@ SynapticsReset(SynapticsPrivate * priv)
     priv->prev_z = 0;
     priv->prevFingers = 0;
     priv->num_active_touches = 0;
+    priv->pointer_slot = -1;
+    priv->finger_slot = -1;
+    memset(&priv->gesture, 0, sizeof(priv->gesture));
+    priv->accel_pressure = 1.0;
 
-    for (i = 0; i < priv->num_slots; i++)
+    for (i = 0; i < priv->num_slots; i++) {
         priv->open_slots[i] = -1;
+        priv->slot_index[i] = -1;
+        if (priv->touch_class)
+            priv->touch_class[i].excluded = FALSE;
+    }
 }
 
 static int
@@ -1100,8 +1512,15 @@ DeviceOff(DeviceIntPtr dev)
 
     if (pInfo->fd != -1) {
         TimerCancel(priv->timer);
+        TimerCancel(priv->replay_timer);
+        TimerCancel(priv->learn.timer);
+        if (priv->learn.dirty)
+            SynapticsPublishCalibration(pInfo);
         xf86RemoveEnabledDevice(pInfo);
         SynapticsReset(priv);
+        SynapticsSetRecording(pInfo, FALSE);
+        SynapticsReplayFree(priv->comm.replay);
+        priv->comm.replay = NULL;
 
         if (priv->proto_ops->DeviceOffHook &&
             !priv->proto_ops->DeviceOffHook(pInfo))
@@ -1126,6 +1545,10 @@ DeviceClose(DeviceIntPtr dev)
     RetValue = DeviceOff(dev);
     TimerFree(priv->timer);
     priv->timer = NULL;
+    TimerFree(priv->replay_timer);
+    priv->replay_timer = NULL;
+    TimerFree(priv->learn.timer);
+    priv->learn.timer = NULL;
     free(priv->touch_axes);
     priv->touch_axes = NULL;
     SynapticsHwStateFree(&priv->hwState);
@@ -1155,10 +1578,17 @@ InitAxesLabels(Atom *labels, int nlabels, const SynapticsPrivate * priv)
 
     for (i = 0; i < priv->num_mt_axes; i++) {
         SynapticsTouchAxisRec *axis = &priv->touch_axes[i];
-        int axnum = nlabels - priv->num_mt_axes + i;
+        int axnum = 4 + i;      /* Skip x, y, and scroll axes */
 
         labels[axnum] = XIGetKnownProperty(axis->label);
     }
+
+    if (priv->pressure.axis >= 0)
+        labels[priv->pressure.axis] =
+            XIGetKnownProperty(AXIS_LABEL_PROP_ABS_PRESSURE);
+    if (priv->pressure.width_axis >= 0)
+        labels[priv->pressure.width_axis] =
+            XIGetKnownProperty(AXIS_LABEL_PROP_ABS_TOOL_WIDTH);
 }
 
 static void
@@ -1190,6 +1620,9 @@ DeviceInitTouch(DeviceIntPtr dev, Atom *axes_labels)
 {
     InputInfoPtr pInfo = dev->public.devicePrivate;
     SynapticsPrivate *priv = (SynapticsPrivate *) (pInfo->private);
+    int i;
+
+    priv->direct_touch = FALSE;
 
     if (!priv->has_touch)
         return;
@@ -1198,12 +1631,62 @@ DeviceInitTouch(DeviceIntPtr dev, Atom *axes_labels)
         priv->max_touches ? priv->max_touches : SYNAPTICS_MAX_TOUCHES;
 
     priv->open_slots = malloc(priv->num_slots * sizeof(int));
-    if (!priv->open_slots) {
+    priv->slot_index = malloc(priv->num_slots * sizeof(int));
+    priv->touch_class = calloc(priv->num_slots,
+                               sizeof(SynapticsTouchClassRec));
+    priv->gesture_touch = calloc(priv->num_slots,
+                                 sizeof(SynapticsGestureTouchRec));
+    if (!priv->open_slots || !priv->slot_index || !priv->touch_class ||
+        !priv->gesture_touch) {
         xf86IDrvMsg(pInfo, X_ERROR,
                     "failed to allocate open touch slots array\n");
+        free(priv->open_slots);
+        free(priv->slot_index);
+        free(priv->touch_class);
+        free(priv->gesture_touch);
+        priv->open_slots = NULL;
+        priv->slot_index = NULL;
+        priv->touch_class = NULL;
+        priv->gesture_touch = NULL;
         priv->has_touch = 0;
         priv->num_slots = 0;
+        return;
+    }
+
+    if (priv->num_slots > SYNAPTICS_MASK_TOUCHES)
+        xf86IDrvMsg(pInfo, X_WARNING,
+                    "%d touch slots, gestures and clickfinger only use the "
+                    "first %d\n", priv->num_slots, SYNAPTICS_MASK_TOUCHES);
+
+    for (i = 0; i < priv->num_mt_axes; i++) {
+        SynapticsTouchAxisRec *axis = &priv->touch_axes[i];
+        int axnum = 4 + i;      /* Skip x, y, and scroll axes */
+
+        xf86InitValuatorAxisStruct(dev, axnum, axes_labels[axnum], axis->min,
+                                   axis->max, axis->res, 0, axis->res,
+                                   Absolute);
+        xf86InitValuatorDefaults(dev, axnum);
+    }
+
+    /* Direct touch needs real contact positions, semi-mt only reports a
+     * bounding box. */
+    if (!xf86SetBoolOption(pInfo->options, "DirectTouch", FALSE))
+        return;
+
+    if (priv->has_semi_mt) {
+        xf86IDrvMsg(pInfo, X_WARNING,
+                    "direct touch is not supported on semi-mt devices\n");
+        return;
     }
+
+    if (!InitTouchClassDeviceStruct(dev, priv->num_slots, XIDirectTouch,
+                                    2 + priv->num_mt_axes)) {
+        xf86IDrvMsg(pInfo, X_ERROR, "failed to initialize touch class\n");
+        return;
+    }
+
+    priv->direct_touch = TRUE;
+    xf86IDrvMsg(pInfo, X_CONFIG, "reporting touches as a direct touch device\n");
 }
 
 static int
@@ -1225,6 +1708,17 @@ DeviceInit(DeviceIntPtr dev)
 
     num_axes += priv->num_mt_axes;
 
+    /* Pressure and contact size for tablet-style absolute mode, queue_pressure
+     * scales by the ranges so an empty one leaves its axis out */
+    priv->pressure.axis = -1;
+    priv->pressure.width_axis = -1;
+    if (priv->has_pressure && priv->maxp > priv->minp &&
+        xf86SetBoolOption(pInfo->options, "PressureValuators", FALSE)) {
+        priv->pressure.axis = num_axes++;
+        if (priv->has_width && priv->maxw > priv->minw)
+            priv->pressure.width_axis = num_axes++;
+    }
+
     axes_labels = calloc(num_axes, sizeof(Atom));
     if (!axes_labels) {
         xf86IDrvMsg(pInfo, X_ERROR, "failed to allocate axis labels\n");
@@ -1325,8 +1819,8 @@ DeviceInit(DeviceIntPtr dev)
     xf86InitValuatorAxisStruct(dev, 3, axes_labels[3], 0, -1, 0, 0, 0,
                                Relative);
     priv->scroll_axis_vert = 3;
-    priv->scroll_events_mask = valuator_mask_new(MAX_VALUATORS);
-    if (!priv->scroll_events_mask) {
+    priv->events_mask = valuator_mask_new(MAX_VALUATORS);
+    if (!priv->events_mask) {
         free(axes_labels);
         return !Success;
     }
@@ -1336,6 +1830,19 @@ DeviceInit(DeviceIntPtr dev)
     SetScrollValuator(dev, priv->scroll_axis_vert, SCROLL_TYPE_VERTICAL,
                       priv->synpara.scroll_dist_vert, 0);
 
+    if (priv->pressure.axis >= 0) {
+        xf86InitValuatorAxisStruct(dev, priv->pressure.axis,
+                                   axes_labels[priv->pressure.axis], 0,
+                                   PRESSURE_AXIS_MAX, 0, 0, 0, Absolute);
+        xf86InitValuatorDefaults(dev, priv->pressure.axis);
+    }
+    if (priv->pressure.width_axis >= 0) {
+        xf86InitValuatorAxisStruct(dev, priv->pressure.width_axis,
+                                   axes_labels[priv->pressure.width_axis], 0,
+                                   PRESSURE_AXIS_MAX, 0, 0, 0, Absolute);
+        xf86InitValuatorDefaults(dev, priv->pressure.width_axis);
+    }
+
     DeviceInitTouch(dev, axes_labels);
 
     free(axes_labels);
@@ -1350,10 +1857,20 @@ DeviceInit(DeviceIntPtr dev)
 
     priv->comm.hwState = SynapticsHwStateAlloc(priv);
 
+    /* allocate now so learning can arm it in the signal handler */
+    priv->learn.timer = TimerSet(NULL, 0, 0, NULL, NULL);
+    if (!priv->learn.timer)
+        goto fail;
+
     InitDeviceProperties(pInfo);
     XIRegisterPropertyHandler(pInfo->dev, SetProperty, NULL, NULL);
 
     SynapticsReset(priv);
+    SynapticsSelectHandleState(priv);
+    SynapticsUpdateAccelProfile(priv);
+    SynapticsUpdatePressureCurve(priv);
+    SynapticsUpdateCalibration(priv);
+    SynapticsResetCalibrationLearning(priv);
 
     return Success;
 
@@ -1361,6 +1878,9 @@ DeviceInit(DeviceIntPtr dev)
     free(priv->local_hw_state);
     free(priv->hwState);
     free(priv->open_slots);
+    free(priv->slot_index);
+    free(priv->touch_class);
+    free(priv->gesture_touch);
     return !Success;
 }
 
@@ -1491,48 +2011,288 @@ is_inside_active_area(SynapticsPrivate * priv, int x, int y)
 }
 
 static Bool
-is_inside_button_area(SynapticsParameters * para, int which, int x, int y)
+has_absolute_zone(const SynapticsParameters * para)
 {
-    Bool inside_area = TRUE;
+    return para->abs_zone_left_edge || para->abs_zone_right_edge ||
+        para->abs_zone_top_edge || para->abs_zone_bottom_edge;
+}
 
-    if (para->softbutton_areas[which][LEFT] == 0 &&
-        para->softbutton_areas[which][RIGHT] == 0 &&
-        para->softbutton_areas[which][TOP] == 0 &&
-        para->softbutton_areas[which][BOTTOM] == 0)
+/*
+ * Check whether a touch-down at x/y starts an absolute touch in hybrid mode.
+ * Edges set to zero don't limit the zone, a zone with all edges zero is
+ * disabled.
+ */
+static Bool
+is_inside_absolute_zone(const SynapticsParameters * para, int x, int y)
+{
+    if (!has_absolute_zone(para))
         return FALSE;
 
-    if (para->softbutton_areas[which][LEFT] &&
-        x < para->softbutton_areas[which][LEFT])
-        inside_area = FALSE;
-    else if (para->softbutton_areas[which][RIGHT] &&
-             x > para->softbutton_areas[which][RIGHT])
-        inside_area = FALSE;
-    else if (para->softbutton_areas[which][TOP] &&
-             y < para->softbutton_areas[which][TOP])
-        inside_area = FALSE;
-    else if (para->softbutton_areas[which][BOTTOM] &&
-             y > para->softbutton_areas[which][BOTTOM])
-        inside_area = FALSE;
+    if ((para->abs_zone_left_edge && x < para->abs_zone_left_edge) ||
+        (para->abs_zone_right_edge && x > para->abs_zone_right_edge) ||
+        (para->abs_zone_top_edge && y < para->abs_zone_top_edge) ||
+        (para->abs_zone_bottom_edge && y > para->abs_zone_bottom_edge))
+        return FALSE;
 
-    return inside_area;
+    return TRUE;
 }
 
-static Bool
-is_inside_rightbutton_area(SynapticsParameters * para, int x, int y)
+/* Stretch the absolute zone over the whole axis range */
+static void
+map_absolute_zone(const SynapticsPrivate * priv, struct SynapticsHwState *hw)
 {
-    return is_inside_button_area(para, BOTTOM_RIGHT_BUTTON_AREA, x, y);
+    const SynapticsParameters *para = &priv->synpara;
+    int left = para->abs_zone_left_edge ? para->abs_zone_left_edge : priv->minx;
+    int right = para->abs_zone_right_edge ? para->abs_zone_right_edge : priv->maxx;
+    int top = para->abs_zone_top_edge ? para->abs_zone_top_edge : priv->miny;
+    int bottom = para->abs_zone_bottom_edge ? para->abs_zone_bottom_edge : priv->maxy;
+    int x = MAX(MIN(hw->x, right), left);
+    int y = MAX(MIN(hw->y, bottom), top);
+
+    if (right > left)
+        hw->x = priv->minx + (double) (x - left) *
+            (priv->maxx - priv->minx) / (right - left);
+    if (bottom > top)
+        hw->y = priv->miny + (double) (y - top) *
+            (priv->maxy - priv->miny) / (bottom - top);
 }
 
-static Bool
-is_inside_middlebutton_area(SynapticsParameters * para, int x, int y)
+/*
+ * Precompute the absolute mode calibration. Must be called whenever the
+ * calibration parameters change.
+ */
+void
+SynapticsUpdateCalibration(SynapticsPrivate * priv)
 {
-    return is_inside_button_area(para, BOTTOM_MIDDLE_BUTTON_AREA, x, y);
-}
+    const SynapticsParameters *para = &priv->synpara;
+    const int *ext = para->calib_extents;
+    int i;
 
-static Bool
-is_inside_sec_rightbutton_area(SynapticsParameters * para, int x, int y)
-{
-    return is_inside_button_area(para, TOP_RIGHT_BUTTON_AREA, x, y);
+    priv->calib.active = ext[0] < ext[1] && ext[2] < ext[3] &&
+        priv->minx < priv->maxx && priv->miny < priv->maxy;
+    if (!priv->calib.active)
+        return;
+
+    priv->calib.scale_x = (double) (priv->maxx - priv->minx) / (ext[1] - ext[0]);
+    priv->calib.scale_y = (double) (priv->maxy - priv->miny) / (ext[3] - ext[2]);
+    priv->calib.cell_inv_x = (CALIB_GRID_SIZE - 1.0) / (priv->maxx - priv->minx);
+    priv->calib.cell_inv_y = (CALIB_GRID_SIZE - 1.0) / (priv->maxy - priv->miny);
+
+    priv->calib.grid = FALSE;
+    for (i = 0; i < CALIB_GRID_VALUES; i++)
+        if (para->calib_grid[i])
+            priv->calib.grid = TRUE;
+}
+
+/* Forget what was learned so far, learning starts over */
+void
+SynapticsResetCalibrationLearning(SynapticsPrivate * priv)
+{
+    int i;
+
+    priv->learn.seen[0] = priv->learn.seen[2] = INT_MAX;
+    priv->learn.seen[1] = priv->learn.seen[3] = INT_MIN;
+
+    for (i = 0; i < 2 * CALIB_GRID_SIZE; i++) {
+        priv->learn.band[2 * i] = INT_MAX;
+        priv->learn.band[2 * i + 1] = INT_MIN;
+    }
+}
+
+/*
+ * Map the reachable extents onto the whole axis range, then add the
+ * correction grid's offset, interpolated between the four nodes around
+ * the position.
+ */
+static void
+apply_calibration(const SynapticsPrivate * priv, struct SynapticsHwState *hw)
+{
+    const SynapticsParameters *para = &priv->synpara;
+    double x, y;
+
+    x = priv->minx + (hw->x - para->calib_extents[0]) * priv->calib.scale_x;
+    y = priv->miny + (hw->y - para->calib_extents[2]) * priv->calib.scale_y;
+    x = MAX(MIN(x, priv->maxx), priv->minx);
+    y = MAX(MIN(y, priv->maxy), priv->miny);
+
+    if (priv->calib.grid) {
+        const int stride = 2 * CALIB_GRID_SIZE;
+        const int *g;
+        double fx = (x - priv->minx) * priv->calib.cell_inv_x;
+        double fy = (y - priv->miny) * priv->calib.cell_inv_y;
+        int cx = MIN((int) fx, CALIB_GRID_SIZE - 2);
+        int cy = MIN((int) fy, CALIB_GRID_SIZE - 2);
+
+        fx -= cx;
+        fy -= cy;
+        g = &para->calib_grid[cy * stride + 2 * cx];
+
+        x += (1 - fy) * ((1 - fx) * g[0] + fx * g[2]) +
+            fy * ((1 - fx) * g[stride] + fx * g[stride + 2]);
+        y += (1 - fy) * ((1 - fx) * g[1] + fx * g[3]) +
+            fy * ((1 - fx) * g[stride + 1] + fx * g[stride + 3]);
+        x = MAX(MIN(x, priv->maxx), priv->minx);
+        y = MAX(MIN(y, priv->maxy), priv->miny);
+    }
+
+    hw->x = lround(x);
+    hw->y = lround(y);
+}
+
+/*
+ * Fit the correction grid to the extents reached in each row and column.
+ * Each grid row is stretched so its own reach spans the axis, the offsets
+ * at the nodes hold the difference to the global mapping. Rows and columns
+ * with too few samples keep no correction.
+ */
+static void
+fit_calibration_grid(SynapticsPrivate * priv)
+{
+    SynapticsParameters *para = &priv->synpara;
+    const int *ext = para->calib_extents;
+    int i, j;
+
+    for (j = 0; j < CALIB_GRID_SIZE; j++) {
+        const int *bx = &priv->learn.band[2 * j];
+        const int *by = &priv->learn.band[2 * (CALIB_GRID_SIZE + j)];
+        double ax = priv->minx + (bx[0] - ext[0]) * priv->calib.scale_x;
+        double bxm = priv->minx + (bx[1] - ext[0]) * priv->calib.scale_x;
+        double ay = priv->miny + (by[0] - ext[2]) * priv->calib.scale_y;
+        double bym = priv->miny + (by[1] - ext[2]) * priv->calib.scale_y;
+        Bool row = bx[0] < bx[1] && bxm - ax > (priv->maxx - priv->minx) / 2;
+        Bool col = by[0] < by[1] && bym - ay > (priv->maxy - priv->miny) / 2;
+
+        for (i = 0; i < CALIB_GRID_SIZE; i++) {
+            double nx = priv->minx + (double) i * (priv->maxx - priv->minx) /
+                (CALIB_GRID_SIZE - 1);
+            double ny = priv->miny + (double) i * (priv->maxy - priv->miny) /
+                (CALIB_GRID_SIZE - 1);
+
+            /* x offsets along row j, y offsets along column j */
+            para->calib_grid[2 * (j * CALIB_GRID_SIZE + i)] = row ?
+                lround(priv->minx + (nx - ax) * (priv->maxx - priv->minx) /
+                       (bxm - ax) - nx) : 0;
+            para->calib_grid[2 * (i * CALIB_GRID_SIZE + j) + 1] = col ?
+                lround(priv->miny + (ny - ay) * (priv->maxy - priv->miny) /
+                       (bym - ay) - ny) : 0;
+        }
+    }
+}
+
+static CARD32
+calibrationTimerFunc(OsTimerPtr timer, CARD32 now, pointer arg)
+{
+    SynapticsPublishCalibration(arg);
+    return 0;
+}
+
+/* Grow the range to include v, TRUE if it changed */
+static inline Bool
+extend_range(int *range, int v)
+{
+    Bool changed = FALSE;
+
+    if (v < range[0]) {
+        range[0] = v;
+        changed = TRUE;
+    }
+    if (v > range[1]) {
+        range[1] = v;
+        changed = TRUE;
+    }
+    return changed;
+}
+
+/*
+ * Learn the reachable extents from the positions of touching fingers. The
+ * result is only applied once the fingers have covered at least half of
+ * the kernel's range on both axes; it is published to the property once it
+ * has been stable for CALIB_PUBLISH_DELAY.
+ */
+static void
+learn_calibration(InputInfoPtr pInfo, const struct SynapticsHwState *hw)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) (pInfo->private);
+    SynapticsParameters *para = &priv->synpara;
+    int *seen = priv->learn.seen;
+    Bool changed;
+
+    changed = extend_range(&seen[0], hw->x);
+    changed |= extend_range(&seen[2], hw->y);
+
+    if (para->calib_fit_grid) {
+        int row = lround((double) (hw->y - priv->miny) *
+                         (CALIB_GRID_SIZE - 1) / (priv->maxy - priv->miny));
+        int col = lround((double) (hw->x - priv->minx) *
+                         (CALIB_GRID_SIZE - 1) / (priv->maxx - priv->minx));
+
+        row = MAX(MIN(row, CALIB_GRID_SIZE - 1), 0);
+        col = MAX(MIN(col, CALIB_GRID_SIZE - 1), 0);
+        changed |= extend_range(&priv->learn.band[2 * row], hw->x);
+        changed |= extend_range(&priv->learn.band[2 * (CALIB_GRID_SIZE + col)],
+                                hw->y);
+    }
+
+    if (!changed ||
+        seen[1] - seen[0] < (priv->maxx - priv->minx) / 2 ||
+        seen[3] - seen[2] < (priv->maxy - priv->miny) / 2)
+        return;
+
+    memcpy(para->calib_extents, seen, sizeof(para->calib_extents));
+    SynapticsUpdateCalibration(priv);
+    if (para->calib_fit_grid) {
+        fit_calibration_grid(priv);
+        SynapticsUpdateCalibration(priv);
+    }
+
+    priv->learn.dirty = TRUE;
+    priv->learn.timer = TimerSet(priv->learn.timer, 0, CALIB_PUBLISH_DELAY,
+                                 calibrationTimerFunc, pInfo);
+}
+
+static Bool
+is_inside_button_area(SynapticsParameters * para, int which, int x, int y)
+{
+    Bool inside_area = TRUE;
+
+    if (para->softbutton_areas[which][LEFT] == 0 &&
+        para->softbutton_areas[which][RIGHT] == 0 &&
+        para->softbutton_areas[which][TOP] == 0 &&
+        para->softbutton_areas[which][BOTTOM] == 0)
+        return FALSE;
+
+    if (para->softbutton_areas[which][LEFT] &&
+        x < para->softbutton_areas[which][LEFT])
+        inside_area = FALSE;
+    else if (para->softbutton_areas[which][RIGHT] &&
+             x > para->softbutton_areas[which][RIGHT])
+        inside_area = FALSE;
+    else if (para->softbutton_areas[which][TOP] &&
+             y < para->softbutton_areas[which][TOP])
+        inside_area = FALSE;
+    else if (para->softbutton_areas[which][BOTTOM] &&
+             y > para->softbutton_areas[which][BOTTOM])
+        inside_area = FALSE;
+
+    return inside_area;
+}
+
+static Bool
+is_inside_rightbutton_area(SynapticsParameters * para, int x, int y)
+{
+    return is_inside_button_area(para, BOTTOM_RIGHT_BUTTON_AREA, x, y);
+}
+
+static Bool
+is_inside_middlebutton_area(SynapticsParameters * para, int x, int y)
+{
+    return is_inside_button_area(para, BOTTOM_MIDDLE_BUTTON_AREA, x, y);
+}
+
+static Bool
+is_inside_sec_rightbutton_area(SynapticsParameters * para, int x, int y)
+{
+    return is_inside_button_area(para, TOP_RIGHT_BUTTON_AREA, x, y);
 }
 
 static Bool
@@ -1605,10 +2365,11 @@ timerFunc(OsTimerPtr timer, CARD32 now, pointer arg)
 
     sigstate = xf86BlockSIGIO();
 
-    priv->hwState->millis += now - priv->timer_time;
+    SynapticsSetHwTime(priv->hwState, priv->hwState->usec +
+                       (CARD64) (now - priv->timer_time) * 1000);
     SynapticsCopyHwState(hw, priv->hwState);
     SynapticsResetTouchHwState(hw, FALSE);
-    delay = HandleState(pInfo, hw, hw->millis, TRUE);
+    delay = priv->handle_state(pInfo, hw, hw->millis, TRUE);
 
     priv->timer_time = now;
     priv->timer = TimerSet(priv->timer, 0, delay, timerFunc, pInfo);
@@ -1650,20 +2411,12 @@ ReadInput(InputInfoPtr pInfo)
     SynapticsResetTouchHwState(hw, FALSE);
 
     while (SynapticsGetHwState(pInfo, priv, hw)) {
-        /* Semi-mt device touch slots do not track touches. When there is a
-         * change in the number of touches, we must disregard the temporary
-         * motion changes. */
-        if (priv->has_semi_mt && hw->numFingers != priv->hwState->numFingers) {
-            hw->cumulative_dx = priv->hwState->cumulative_dx;
-            hw->cumulative_dy = priv->hwState->cumulative_dy;
-        }
-
         /* timer may cause actual events to lag behind (#48777) */
-        if (priv->hwState->millis > hw->millis)
-            hw->millis = priv->hwState->millis;
+        if (priv->hwState->usec > hw->usec)
+            SynapticsSetHwTime(hw, priv->hwState->usec);
 
         SynapticsCopyHwState(priv->hwState, hw);
-        delay = HandleState(pInfo, hw, hw->millis, FALSE);
+        delay = priv->handle_state(pInfo, hw, hw->millis, FALSE);
         newDelay = TRUE;
     }
 
@@ -1673,6 +2426,38 @@ ReadInput(InputInfoPtr pInfo)
     }
 }
 
+/*
+ * Process the replayed input that is due and wait for the next one.
+ */
+static CARD32
+replayTimerFunc(OsTimerPtr timer, CARD32 now, pointer arg)
+{
+    InputInfoPtr pInfo = arg;
+    SynapticsPrivate *priv = (SynapticsPrivate *) (pInfo->private);
+    int delay;
+    int sigstate;
+
+    sigstate = xf86BlockSIGIO();
+
+    ReadInput(pInfo);
+
+    delay = SynapticsReplayDelay(priv->comm.replay);
+    if (delay < 0) {
+        SynapticsReplayFree(priv->comm.replay);
+        priv->comm.replay = NULL;
+    }
+
+    xf86UnblockSIGIO(sigstate);
+
+    if (delay < 0) {
+        xf86IDrvMsg(pInfo, X_INFO, "replay of %s finished\n",
+                    priv->replay_file);
+        return 0;
+    }
+
+    return MAX(delay, 1);
+}
+
 static int
 HandleMidButtonEmulation(SynapticsPrivate * priv, struct SynapticsHwState *hw,
                          CARD32 now, int *delay)
@@ -1773,6 +2558,275 @@ HandleMidButtonEmulation(SynapticsPrivate * priv, struct SynapticsHwState *hw,
     return mid;
 }
 
+static inline int
+popcount32(uint32_t v)
+{
+    v = v - ((v >> 1) & 0x55555555);
+    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+    return (((v + (v >> 4)) & 0x0f0f0f0f) * 0x01010101) >> 24;
+}
+
+#define TOUCH_CLASSIFY_TIME 80  /* ms until a resting touch is classified */
+
+/* Palms and thumbs are left out of motion, tapping and clickfinger */
+static inline Bool
+touch_excluded(const SynapticsPrivate * priv, int slot)
+{
+    return priv->touch_class && priv->touch_class[slot].cls >= TC_THUMB;
+}
+
+/*
+ * Classify one touch as finger, thumb or palm. The decision is made once
+ * and cached until the touch is released; only a finger can still turn
+ * into a palm later, as palms often grow after touch-down.
+ *
+ * @param others Number of other touches currently on the pad
+ */
+static void
+classify_touch(SynapticsPrivate * priv, const struct SynapticsHwState *hw,
+               int slot, CARD32 now, int others)
+{
+    SynapticsParameters *para = &priv->synpara;
+    SynapticsTouchClassRec *tc = &priv->touch_class[slot];
+    int major = hw->touch_major[slot];
+    int minor = hw->touch_minor[slot];
+    int move_x = (priv->maxx - priv->minx) / 40;
+    int move_y = (priv->maxy - priv->miny) / 40;
+
+    if (tc->cls >= TC_THUMB)
+        return;
+
+    /* Big and heavy is a palm, wherever it is */
+    if (priv->has_mt_palm_detect && major > para->palm_min_width &&
+        hw->touch_pressure[slot] > para->palm_min_z) {
+        DBG(7, "slot %d classified as palm\n", slot);
+        tc->cls = TC_PALM;
+        return;
+    }
+
+    if (tc->cls != TC_UNDECIDED)
+        return;
+
+    /* Anything moving right after touch-down is a finger */
+    if (abs(hw->touch_x[slot] - tc->start_x) > move_x ||
+        abs(hw->touch_y[slot] - tc->start_y) > move_y) {
+        tc->cls = TC_FINGER;
+        return;
+    }
+
+    if (TIME_DIFF(now, tc->start_millis) < TOUCH_CLASSIFY_TIME)
+        return;
+
+    /* Resting at the bottom edge next to another touch, or an elongated
+     * contact there: a thumb */
+    if (tc->start_y > para->bottom_edge &&
+        (others > 0 || (minor > 0 && major > 2 * minor))) {
+        DBG(7, "slot %d classified as thumb\n", slot);
+        tc->cls = TC_THUMB;
+    }
+    else
+        tc->cls = TC_FINGER;
+}
+
+/*
+ * Run the per-touch classifier and remove palms and thumbs from the
+ * hardware state: they no longer count as fingers, and the position and
+ * size are taken from a real finger if there is one.
+ */
+static void
+classify_touches(SynapticsPrivate * priv, struct SynapticsHwState *hw,
+                 CARD32 now)
+{
+    int i, active = 0, excluded = 0, finger_slot = -1;
+    Bool changed = FALSE;
+
+    if (!priv->has_touch || !priv->touch_class)
+        return;
+
+    for (i = 0; i < hw->num_mt_mask; i++) {
+        if (hw->slot_state[i] == SLOTSTATE_OPEN) {
+            SynapticsTouchClassRec *tc = &priv->touch_class[i];
+
+            /* Semi-mt slots are a bounding box, not touches */
+            tc->cls = (priv->synpara.palm_detect && !priv->has_semi_mt) ?
+                TC_UNDECIDED : TC_FINGER;
+            tc->start_millis = now;
+            tc->start_x = hw->touch_x[i];
+            tc->start_y = hw->touch_y[i];
+        }
+        if (hw->slot_state[i] != SLOTSTATE_EMPTY &&
+            hw->slot_state[i] != SLOTSTATE_CLOSE)
+            active++;
+    }
+
+    for (i = 0; i < hw->num_mt_mask; i++) {
+        SynapticsTouchClassRec *tc = &priv->touch_class[i];
+        Bool ex = FALSE;
+
+        if (hw->slot_state[i] != SLOTSTATE_EMPTY &&
+            hw->slot_state[i] != SLOTSTATE_CLOSE) {
+            classify_touch(priv, hw, i, now, active - 1);
+            ex = touch_excluded(priv, i);
+            if (ex)
+                excluded++;
+            else if (finger_slot == -1)
+                finger_slot = i;
+        }
+
+        if (ex != tc->excluded)
+            changed = TRUE;
+        tc->excluded = ex;
+    }
+
+    /* The position comes from another touch now, don't turn the jump into
+     * motion */
+    if (changed || (excluded && finger_slot != priv->finger_slot))
+        priv->count_packet_finger = 0;
+    priv->finger_slot = finger_slot;
+
+    if (excluded == 0)
+        return;
+
+    if (finger_slot == -1) {
+        hw->numFingers = 0;
+        hw->z = 0;
+        hw->fingerWidth = 0;
+        return;
+    }
+
+    hw->numFingers = MAX(hw->numFingers - excluded, 1);
+    hw->x = hw->touch_x[finger_slot];
+    hw->y = hw->touch_y[finger_slot];
+    if (priv->has_mt_palm_detect) {
+        hw->z = hw->touch_pressure[finger_slot];
+        hw->fingerWidth = hw->touch_major[finger_slot];
+    }
+}
+
+/* Tracking IDs increase with every new touch and wrap around at 16 bit */
+#define TRACKING_ID_BEFORE(a, b) ((int16_t) ((a) - (b)) < 0)
+
+static inline Bool
+touch_slot_active(const struct SynapticsHwState *hw, int slot)
+{
+    return hw->slot_state[slot] != SLOTSTATE_EMPTY &&
+        hw->slot_state[slot] != SLOTSTATE_CLOSE;
+}
+
+/*
+ * Pick the touch that drives the pointer on a clickpad. The oldest touch
+ * (lowest tracking ID) is chosen and keeps the pointer until it lifts,
+ * except that a touch resting in a soft button area gives way to one
+ * outside of it - that is the finger doing the dragging while the other
+ * one holds the click. The pointer position is then taken from that touch.
+ */
+static void
+update_pointer_slot(SynapticsPrivate * priv, struct SynapticsHwState *hw)
+{
+    SynapticsParameters *para = &priv->synpara;
+    int cur = priv->pointer_slot;
+    int i;
+
+    if (!para->clickpad || !priv->has_touch || priv->has_semi_mt)
+        return;
+
+    if (cur != -1 && (!touch_slot_active(hw, cur) || touch_excluded(priv, cur)))
+        cur = -1;
+
+    if (cur == -1 ||
+        current_button_area(para, hw->touch_x[cur],
+                            hw->touch_y[cur]) != NO_BUTTON_AREA) {
+        int best = -1;
+
+        for (i = 0; i < hw->num_mt_mask; i++) {
+            if (i == cur || !touch_slot_active(hw, i) || touch_excluded(priv, i))
+                continue;
+            if (cur != -1 &&
+                current_button_area(para, hw->touch_x[i],
+                                    hw->touch_y[i]) != NO_BUTTON_AREA)
+                continue;
+            if (best == -1 ||
+                TRACKING_ID_BEFORE(hw->touch_id[i], hw->touch_id[best]))
+                best = i;
+        }
+
+        if (best != -1)
+            cur = best;
+    }
+
+    if (cur != priv->pointer_slot) {
+        DBG(7, "pointer slot %d -> %d\n", priv->pointer_slot, cur);
+        priv->pointer_slot = cur;
+        /* The new touch is somewhere else, start over with its motion and
+         * its button area */
+        priv->count_packet_finger = 0;
+        if (cur != -1)
+            priv->last_button_area =
+                current_button_area(para, hw->touch_x[cur], hw->touch_y[cur]);
+    }
+
+    if (cur != -1) {
+        hw->x = hw->touch_x[cur];
+        hw->y = hw->touch_y[cur];
+    }
+}
+
+/* Geometry of the touches currently on the pad */
+struct TouchGeometry {
+    uint32_t active;            /* 1 bit for each slot holding a touch */
+    uint32_t close_point;       /* 1 bit for each point close to another one */
+};
+
+/* Only the first SYNAPTICS_MASK_TOUCHES slots are looked at, DeviceInitTouch
+ * warns about devices with more */
+static void
+touch_geometry(const SynapticsPrivate * priv,
+               const struct SynapticsHwState *hw, struct TouchGeometry *g)
+{
+    const int *tx = hw->touch_x;
+    const int *ty = hw->touch_y;
+    int width = priv->maxx - priv->minx;
+    int height = priv->maxy - priv->miny;
+    int num_slots = MIN(hw->num_mt_mask, SYNAPTICS_MASK_TOUCHES);
+    int i, j;
+
+    memset(g, 0, sizeof(*g));
+
+    for (i = 0; i < num_slots; i++) {
+        if (hw->slot_state[i] == SLOTSTATE_EMPTY ||
+            hw->slot_state[i] == SLOTSTATE_CLOSE || touch_excluded(priv, i))
+            continue;
+
+        g->active |= (1U << i);
+    }
+
+    if (!g->active)
+        return;
+
+    for (i = 0; i < num_slots - 1; i++) {
+        uint32_t close = 0;
+
+        if (!(g->active & (1U << i)))
+            continue;
+
+        /* FIXME: fingers closer together than 30% of touchpad width, but
+         * really, this should be dependent on the touchpad size. Also,
+         * you'll need to find a touchpad that doesn't lie about it's
+         * size. Good luck. */
+        for (j = i + 1; j < num_slots; j++) {
+            int dx = abs(tx[i] - tx[j]);
+            int dy = abs(ty[i] - ty[j]);
+
+            close |= (uint32_t) (dx * 10 < width * 3 &&
+                                 dy * 10 < height * 3) << j;
+        }
+
+        close &= g->active;
+        if (close)
+            g->close_point |= close | (1U << i);
+    }
+}
+
 static enum FingerState
 SynapticsDetectFinger(SynapticsPrivate * priv, struct SynapticsHwState *hw)
 {
@@ -1879,36 +2933,150 @@ SelectTapButton(SynapticsPrivate * priv, enum EdgeType edge)
     priv->tap_button = clamp(priv->tap_button, 0, SYN_MAX_BUTTONS);
 }
 
+/*
+ * The tap/drag state machine is described by two tables: what happens when
+ * a state is entered, and which transitions leave it. Each packet is turned
+ * into a set of TE_* bits and the first rule of the current state whose
+ * bits are all set fires.
+ */
+
+#define TAP_TIMEOUT(field) offsetof(SynapticsParameters, field)
+
+/* Entering a state */
+static const struct {
+    int button;                 /* New tap_button_state, or -1 to keep it */
+    int timeout;                /* Offset of the timeout parameter, or -1 */
+} tap_states[] = {
+    [TS_START] = {TBS_BUTTON_UP, -1},
+    [TS_1] = {TBS_BUTTON_UP, TAP_TIMEOUT(tap_time)},
+    [TS_MOVE] = {-1, -1},
+    [TS_2A] = {TBS_BUTTON_UP, TAP_TIMEOUT(single_tap_timeout)},
+    [TS_2B] = {TBS_BUTTON_UP, TAP_TIMEOUT(tap_time_2)},
+    [TS_SINGLETAP] = {TBS_BUTTON_DOWN, TAP_TIMEOUT(click_time)},
+    [TS_3] = {TBS_BUTTON_DOWN, TAP_TIMEOUT(tap_time)},
+    [TS_DRAG] = {-1, -1},
+    [TS_4] = {-1, TAP_TIMEOUT(locked_drag_time)},
+    [TS_5] = {-1, TAP_TIMEOUT(tap_time)},
+    [TS_CLICKPAD_MOVE] = {-1, -1},
+};
+
+/* Inputs to the state machine, computed once per packet */
+enum TapInput {
+    TE_ALWAYS = (1 << 0),
+    TE_TOUCH = (1 << 1),        /* Finger put down */
+    TE_RELEASE = (1 << 2),      /* Finger lifted */
+    TE_MOVE = (1 << 3),         /* Finger moved more than tap_move */
+    TE_TIMEOUT = (1 << 4),      /* Deadline of the current state passed */
+    TE_PRESS = (1 << 5),        /* Clickpad button pressed */
+    TE_UNPRESS = (1 << 6),      /* No physical button pressed */
+    TE_DRAG_GESTURE = (1 << 7), /* tap_and_drag_gesture is enabled */
+    TE_LOCKED_DRAGS = (1 << 8), /* locked_drags is enabled */
+};
+
+enum TapAction {
+    TA_NONE,
+    TA_MOVING_ON,               /* Start pointer motion */
+    TA_MOVING_ON_IF_TOUCHED,    /* ... if the finger is still down */
+    TA_MOVING_OFF,              /* Stop pointer motion */
+    TA_SELECT_BUTTON,           /* Pick the button for the tap */
+    TA_CLICKPAD_HOLD,           /* Clickpad button is held down */
+    TA_CLICKPAD_RELEASE,        /* Clickpad button was released */
+};
+
+#define TS_STAY -1              /* Don't change the state */
+#define TAP_RULES_MAX 6
+
+static const struct TapRule {
+    unsigned int when;          /* TE_* bits that must all be set, 0 ends */
+    enum TapAction action;
+    int next;                   /* New state, or TS_STAY */
+    Bool restart;               /* Apply the rules of the new state too */
+} tap_rules[][TAP_RULES_MAX] = {
+    [TS_START] = {
+        {TE_TOUCH, TA_NONE, TS_1, FALSE},
+    },
+    [TS_1] = {
+        {TE_PRESS, TA_NONE, TS_CLICKPAD_MOVE, TRUE},
+        {TE_MOVE, TA_MOVING_ON, TS_MOVE, TRUE},
+        {TE_TIMEOUT, TA_MOVING_ON_IF_TOUCHED, TS_MOVE, TRUE},
+        {TE_RELEASE, TA_SELECT_BUTTON, TS_2A, FALSE},
+    },
+    [TS_MOVE] = {
+        {TE_PRESS, TA_NONE, TS_CLICKPAD_MOVE, TRUE},
+        {TE_RELEASE, TA_MOVING_OFF, TS_START, FALSE},
+    },
+    [TS_2A] = {
+        {TE_TOUCH, TA_NONE, TS_3, FALSE},
+        {TE_TIMEOUT, TA_NONE, TS_SINGLETAP, FALSE},
+    },
+    [TS_2B] = {
+        {TE_TOUCH, TA_NONE, TS_3, FALSE},
+        {TE_TIMEOUT, TA_NONE, TS_SINGLETAP, FALSE},
+    },
+    [TS_SINGLETAP] = {
+        {TE_TOUCH, TA_NONE, TS_1, FALSE},
+        {TE_TIMEOUT, TA_NONE, TS_START, FALSE},
+    },
+    [TS_3] = {
+        {TE_MOVE | TE_DRAG_GESTURE, TA_MOVING_ON, TS_DRAG, TRUE},
+        {TE_MOVE, TA_NONE, TS_1, TRUE},
+        {TE_TIMEOUT | TE_DRAG_GESTURE, TA_MOVING_ON_IF_TOUCHED, TS_DRAG, TRUE},
+        {TE_TIMEOUT, TA_NONE, TS_1, TRUE},
+        {TE_RELEASE, TA_NONE, TS_2B, FALSE},
+    },
+    [TS_DRAG] = {
+        {TE_PRESS, TA_NONE, TS_CLICKPAD_MOVE, TRUE},
+        {TE_MOVE, TA_MOVING_ON, TS_STAY, FALSE},
+        {TE_RELEASE | TE_LOCKED_DRAGS, TA_MOVING_OFF, TS_4, FALSE},
+        {TE_RELEASE, TA_MOVING_OFF, TS_START, FALSE},
+    },
+    [TS_4] = {
+        {TE_TIMEOUT, TA_NONE, TS_START, TRUE},
+        {TE_TOUCH, TA_NONE, TS_5, FALSE},
+    },
+    [TS_5] = {
+        {TE_TIMEOUT, TA_NONE, TS_DRAG, TRUE},
+        {TE_MOVE, TA_NONE, TS_DRAG, TRUE},
+        {TE_RELEASE, TA_MOVING_OFF, TS_START, FALSE},
+    },
+    [TS_CLICKPAD_MOVE] = {
+        {TE_UNPRESS, TA_CLICKPAD_RELEASE, TS_MOVE, FALSE},
+        {TE_ALWAYS, TA_CLICKPAD_HOLD, TS_STAY, FALSE},
+    },
+};
+
+/*
+ * The deadline of the current state, relative to the last touch or
+ * release.
+ */
+static void
+SetTapDeadline(SynapticsPrivate * priv)
+{
+    int timeout = tap_states[priv->tap_state].timeout;
+
+    if (timeout >= 0)
+        priv->tap_deadline = priv->touch_on.millis +
+            *(const int *) ((const char *) &priv->synpara + timeout);
+}
+
+/*
+ * Enter a tap state. The deadline of the state is fixed here.
+ */
 static void
 SetTapState(SynapticsPrivate * priv, enum TapState tap_state, CARD32 millis)
 {
     DBG(3, "SetTapState - %d -> %d (millis:%u)\n", priv->tap_state, tap_state,
         millis);
-    switch (tap_state) {
-    case TS_START:
-        priv->tap_button_state = TBS_BUTTON_UP;
+
+    if (tap_states[tap_state].button >= 0)
+        priv->tap_button_state = tap_states[tap_state].button;
+    if (tap_state == TS_START)
         priv->tap_max_fingers = 0;
-        break;
-    case TS_1:
-        priv->tap_button_state = TBS_BUTTON_UP;
-        break;
-    case TS_2A:
-        priv->tap_button_state = TBS_BUTTON_UP;
-        break;
-    case TS_2B:
-        priv->tap_button_state = TBS_BUTTON_UP;
-        break;
-    case TS_3:
-        priv->tap_button_state = TBS_BUTTON_DOWN;
-        break;
-    case TS_SINGLETAP:
-        priv->tap_button_state = TBS_BUTTON_DOWN;
+    else if (tap_state == TS_SINGLETAP)
         priv->touch_on.millis = millis;
-        break;
-    default:
-        break;
-    }
+
     priv->tap_state = tap_state;
+    SetTapDeadline(priv);
 }
 
 static void
@@ -1922,38 +3090,75 @@ SetMovingState(SynapticsPrivate * priv, enum MovingState moving_state,
     priv->moving_state = moving_state;
 }
 
-static int
-GetTimeOut(SynapticsPrivate * priv)
+static void
+TapAction(SynapticsPrivate * priv, struct SynapticsHwState *hw,
+          enum TapAction action, CARD32 now, enum FingerState finger,
+          Bool inside_active_area)
 {
-    SynapticsParameters *para = &priv->synpara;
+    switch (action) {
+    case TA_NONE:
+        break;
+    case TA_MOVING_ON:
+        SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
+        break;
+    case TA_MOVING_ON_IF_TOUCHED:
+        if (finger == FS_TOUCHED)
+            SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
+        break;
+    case TA_MOVING_OFF:
+        SetMovingState(priv, MS_FALSE, now);
+        break;
+    case TA_SELECT_BUTTON:
+        SelectTapButton(priv, edge_detection(priv, priv->touch_on.x,
+                                             priv->touch_on.y));
+        /* Disable taps outside of the active area, and for fingers
+         * that just made a gesture */
+        if (!inside_active_area || priv->gesture.fired)
+            priv->tap_button = 0;
+        break;
+    case TA_CLICKPAD_HOLD:
+    case TA_CLICKPAD_RELEASE:
+        /* Disable scrolling once a button is pressed on a clickpad */
+        priv->vert_scroll_edge_on = FALSE;
+        priv->horiz_scroll_edge_on = FALSE;
+        priv->vert_scroll_twofinger_on = FALSE;
+        priv->horiz_scroll_twofinger_on = FALSE;
 
-    switch (priv->tap_state) {
-    case TS_1:
-    case TS_3:
-    case TS_5:
-        return para->tap_time;
-    case TS_SINGLETAP:
-        return para->click_time;
-    case TS_2A:
-        return para->single_tap_timeout;
-    case TS_2B:
-        return para->tap_time_2;
-    case TS_4:
-        return para->locked_drag_time;
-    default:
-        return -1;              /* No timeout */
+        /* Assume one touch is only for holding the clickpad button down */
+        if (hw->numFingers > 1)
+            hw->numFingers--;
+
+        if (action == TA_CLICKPAD_HOLD)
+            SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
+        else {
+            SetMovingState(priv, MS_FALSE, now);
+            priv->count_packet_finger = 0;
+        }
+        break;
     }
 }
 
+/* The first rule of the state that applies to the events, or NULL */
+static const struct TapRule *
+MatchTapRule(int tap_state, unsigned int events)
+{
+    const struct TapRule *rule;
+
+    for (rule = tap_rules[tap_state]; rule->when; rule++)
+        if ((events & rule->when) == rule->when)
+            return rule;
+    return NULL;
+}
+
 static int
 HandleTapProcessing(SynapticsPrivate * priv, struct SynapticsHwState *hw,
                     CARD32 now, enum FingerState finger,
                     Bool inside_active_area)
 {
     SynapticsParameters *para = &priv->synpara;
-    Bool touch, release, is_timeout, move, press;
-    int timeleft, timeout;
-    enum EdgeType edge;
+    Bool touch, release, move, press;
+    unsigned int events;
+    const struct TapRule *rule;
     int delay = 1000000000;
 
     if (para->touchpad_off == TOUCHPAD_OFF ||
@@ -1974,165 +3179,52 @@ HandleTapProcessing(SynapticsPrivate * priv, struct SynapticsHwState *hw,
     if (touch) {
         priv->touch_on.x = hw->x;
         priv->touch_on.y = hw->y;
-        priv->touch_on.millis = now;
-    }
-    else if (release) {
-        priv->touch_on.millis = now;
-    }
-    if (hw->z > para->finger_high)
-        if (priv->tap_max_fingers < hw->numFingers)
-            priv->tap_max_fingers = hw->numFingers;
-    timeout = GetTimeOut(priv);
-    timeleft = TIME_DIFF(priv->touch_on.millis + timeout, now);
-    is_timeout = timeleft <= 0;
-
- restart:
-    switch (priv->tap_state) {
-    case TS_START:
-        if (touch)
-            SetTapState(priv, TS_1, now);
-        break;
-    case TS_1:
-        if (para->clickpad && press) {
-            SetTapState(priv, TS_CLICKPAD_MOVE, now);
-            goto restart;
-        }
-        if (move) {
-            SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
-            SetTapState(priv, TS_MOVE, now);
-            goto restart;
-        }
-        else if (is_timeout) {
-            if (finger == FS_TOUCHED) {
-                SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
-            }
-            SetTapState(priv, TS_MOVE, now);
-            goto restart;
-        }
-        else if (release) {
-            edge = edge_detection(priv, priv->touch_on.x, priv->touch_on.y);
-            SelectTapButton(priv, edge);
-            /* Disable taps outside of the active area */
-            if (!inside_active_area) {
-                priv->tap_button = 0;
-            }
-            SetTapState(priv, TS_2A, now);
-        }
-        break;
-    case TS_MOVE:
-        if (para->clickpad && press) {
-            SetTapState(priv, TS_CLICKPAD_MOVE, now);
-            goto restart;
-        }
-        if (release) {
-            SetMovingState(priv, MS_FALSE, now);
-            SetTapState(priv, TS_START, now);
-        }
-        break;
-    case TS_2A:
-        if (touch)
-            SetTapState(priv, TS_3, now);
-        else if (is_timeout)
-            SetTapState(priv, TS_SINGLETAP, now);
-        break;
-    case TS_2B:
-        if (touch)
-            SetTapState(priv, TS_3, now);
-        else if (is_timeout)
-            SetTapState(priv, TS_SINGLETAP, now);
-        break;
-    case TS_SINGLETAP:
-        if (touch)
-            SetTapState(priv, TS_1, now);
-        else if (is_timeout)
-            SetTapState(priv, TS_START, now);
-        break;
-    case TS_3:
-        if (move) {
-            if (para->tap_and_drag_gesture) {
-                SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
-                SetTapState(priv, TS_DRAG, now);
-            }
-            else {
-                SetTapState(priv, TS_1, now);
-            }
-            goto restart;
-        }
-        else if (is_timeout) {
-            if (para->tap_and_drag_gesture) {
-                if (finger == FS_TOUCHED) {
-                    SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
-                }
-                SetTapState(priv, TS_DRAG, now);
-            }
-            else {
-                SetTapState(priv, TS_1, now);
-            }
-            goto restart;
-        }
-        else if (release) {
-            SetTapState(priv, TS_2B, now);
-        }
-        break;
-    case TS_DRAG:
-        if (para->clickpad && press) {
-            SetTapState(priv, TS_CLICKPAD_MOVE, now);
-            goto restart;
-        }
-        if (move)
-            SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
-        if (release) {
-            SetMovingState(priv, MS_FALSE, now);
-            if (para->locked_drags) {
-                SetTapState(priv, TS_4, now);
-            }
-            else {
-                SetTapState(priv, TS_START, now);
-            }
-        }
-        break;
-    case TS_4:
-        if (is_timeout) {
-            SetTapState(priv, TS_START, now);
-            goto restart;
-        }
-        if (touch)
-            SetTapState(priv, TS_5, now);
-        break;
-    case TS_5:
-        if (is_timeout || move) {
-            SetTapState(priv, TS_DRAG, now);
-            goto restart;
-        }
-        else if (release) {
-            SetMovingState(priv, MS_FALSE, now);
-            SetTapState(priv, TS_START, now);
-        }
-        break;
-    case TS_CLICKPAD_MOVE:
-        /* Disable scrolling once a button is pressed on a clickpad */
-        priv->vert_scroll_edge_on = FALSE;
-        priv->horiz_scroll_edge_on = FALSE;
-        priv->vert_scroll_twofinger_on = FALSE;
-        priv->horiz_scroll_twofinger_on = FALSE;
-
-        /* Assume one touch is only for holding the clickpad button down */
-        if (hw->numFingers > 1)
-            hw->numFingers--;
-        SetMovingState(priv, MS_TOUCHPAD_RELATIVE, now);
-        if (!press) {
-            SetMovingState(priv, MS_FALSE, now);
-            SetTapState(priv, TS_MOVE, now);
-            priv->count_packet_finger = 0;
-        }
-        break;
+        priv->touch_on.millis = now;
     }
-
-    timeout = GetTimeOut(priv);
-    if (timeout >= 0) {
-        timeleft = TIME_DIFF(priv->touch_on.millis + timeout, now);
-        delay = clamp(timeleft, 1, delay);
+    else if (release) {
+        priv->touch_on.millis = now;
     }
+    if (hw->z > para->finger_high)
+        if (priv->tap_max_fingers < hw->numFingers)
+            priv->tap_max_fingers = hw->numFingers;
+
+    /* A touch or release starts the timeout over, so it is handled before
+     * a deadline that passed in the same packet */
+    if (touch || release)
+        SetTapDeadline(priv);
+
+    events = TE_ALWAYS;
+    if (touch)
+        events |= TE_TOUCH;
+    if (release)
+        events |= TE_RELEASE;
+    if (move)
+        events |= TE_MOVE;
+    if (tap_states[priv->tap_state].timeout >= 0 &&
+        TIME_DIFF(priv->tap_deadline, now) <= 0)
+        events |= TE_TIMEOUT;
+    if (para->clickpad && press)
+        events |= TE_PRESS;
+    if (!press)
+        events |= TE_UNPRESS;
+    if (para->tap_and_drag_gesture)
+        events |= TE_DRAG_GESTURE;
+    if (para->locked_drags)
+        events |= TE_LOCKED_DRAGS;
+
+    do {
+        rule = MatchTapRule(priv->tap_state, events);
+        if (!rule)
+            break;
+
+        TapAction(priv, hw, rule->action, now, finger, inside_active_area);
+        if (rule->next != TS_STAY)
+            SetTapState(priv, rule->next, now);
+    } while (rule->restart);
+
+    if (tap_states[priv->tap_state].timeout >= 0)
+        delay = clamp(TIME_DIFF(priv->tap_deadline, now), 1, delay);
+
     return delay;
 }
 
@@ -2140,13 +3232,13 @@ HandleTapProcessing(SynapticsPrivate * priv, struct SynapticsHwState *hw,
 #define HIST_DELTA(a, b, e) ((HIST((a)).e) - (HIST((b)).e))
 
 static void
-store_history(SynapticsPrivate * priv, int x, int y, CARD32 millis)
+store_history(SynapticsPrivate * priv, int x, int y, CARD64 usec)
 {
     int idx = (priv->hist_index + 1) % SYNAPTICS_MOVE_HISTORY;
 
     priv->move_hist[idx].x = x;
     priv->move_hist[idx].y = y;
-    priv->move_hist[idx].millis = millis;
+    priv->move_hist[idx].usec = usec;
     priv->hist_index = idx;
     if (priv->count_packet_finger < SYNAPTICS_MOVE_HISTORY)
         priv->count_packet_finger++;
@@ -2190,37 +3282,32 @@ hysteresis(int in, int center, int margin)
 
 static void
 get_delta(SynapticsPrivate *priv, const struct SynapticsHwState *hw,
-          enum EdgeType edge, double *dx, double *dy)
+          enum EdgeType edge, int *dx, int *dy)
 {
-    double integral;
-    double tmpf;
-
-    *dx = hw->x - HIST(0).x;
-    *dy = hw->y - HIST(0).y;
+    INT64 qx, qy;
 
     /* report edge speed as synthetic motion. Of course, it would be
-     * cooler to report floats than to buffer, but anyway. */
-
-    /* FIXME: When these values go NaN, bad things happen. Root cause is unknown
-     * thus far though. */
-    if (isnan(priv->frac_x))
-        priv->frac_x = 0;
-    if (isnan(priv->frac_y))
-        priv->frac_y = 0;
-
-    tmpf = *dx + priv->frac_x;
-    priv->frac_x = modf(tmpf, &integral);
-    *dx = integral;
-    tmpf = *dy + priv->frac_y;
-    priv->frac_y = modf(tmpf, &integral);
-    *dy = integral;
+     * cooler to report floats than to buffer, but anyway. The fractions
+     * are Q16 and truncate towards zero. */
+    qx = (INT64) (hw->x - HIST(0).x) * Q16_ONE + priv->frac_x;
+    qy = (INT64) (hw->y - HIST(0).y) * Q16_ONE + priv->frac_y;
+
+    *dx = qx / Q16_ONE;
+    *dy = qy / Q16_ONE;
+    priv->frac_x = qx - (INT64) *dx * Q16_ONE;
+    priv->frac_y = qy - (INT64) *dy * Q16_ONE;
 }
 
-/* Vector length, but not sqrt'ed, we only need it for comparison */
-static inline double
-vlenpow2(double x, double y)
+/*
+ * Check a delta against maxDeltaMM. The squared length in mm is compared
+ * with both sides multiplied by the squared resolutions, so no division is
+ * needed.
+ */
+static inline Bool
+exceeds_max_delta(const SynapticsPrivate * priv, int dx, int dy)
 {
-    return x * x + y * y;
+    return (CARD64) ((INT64) dx * dx) * priv->delta_weight_x +
+        (CARD64) ((INT64) dy * dy) * priv->delta_weight_y > priv->max_delta;
 }
 
 /**
@@ -2231,8 +3318,7 @@ ComputeDeltas(SynapticsPrivate * priv, const struct SynapticsHwState *hw,
               enum EdgeType edge, int *dxP, int *dyP, Bool inside_area)
 {
     enum MovingState moving_state;
-    double dx, dy;
-    double vlen;
+    int dx, dy;
     int delay = 1000000000;
 
     dx = dy = 0;
@@ -2278,10 +3364,7 @@ ComputeDeltas(SynapticsPrivate * priv, const struct SynapticsHwState *hw,
  out:
     priv->prevFingers = hw->numFingers;
 
-    vlen = vlenpow2(dx/priv->synpara.resolution_horiz,
-                    dy/priv->synpara.resolution_vert);
-
-    if (vlen > priv->synpara.maxDeltaMM * priv->synpara.maxDeltaMM) {
+    if (exceeds_max_delta(priv, dx, dy)) {
         dx = 0;
         dy = 0;
     }
@@ -2319,7 +3402,7 @@ start_coasting(SynapticsPrivate * priv, struct SynapticsHwState *hw,
     priv->scroll.coast_delta_x = 0.0;
 
     if ((priv->scroll.packets_this_scroll > 3) && (para->coasting_speed > 0.0)) {
-        double pkt_time = HIST_DELTA(0, 3, millis) / 1000.0;
+        double pkt_time = (INT64) HIST_DELTA(0, 3, usec) / 1000000.0;
 
         if (vert && !circ) {
             double dy =
@@ -2379,6 +3462,22 @@ stop_coasting(SynapticsPrivate * priv)
     priv->scroll.packets_this_scroll = 0;
 }
 
+/*
+ * The backend lost events and rebuilt the hardware state from the device.
+ * Forget what was derived from the lost part: the motion history, so the
+ * next delta is not one big jump, coasting, a gesture in progress, and a
+ * touch that would turn into a tap although its release was never seen.
+ */
+void
+SynapticsResyncState(SynapticsPrivate * priv)
+{
+    priv->count_packet_finger = 0;
+    stop_coasting(priv);
+    memset(&priv->gesture, 0, sizeof(priv->gesture));
+    if (priv->tap_state == TS_1)
+        SetTapState(priv, TS_MOVE, priv->touch_on.millis);
+}
+
 static int
 HandleScrolling(SynapticsPrivate * priv, struct SynapticsHwState *hw,
                 enum EdgeType edge, Bool finger)
@@ -2608,7 +3707,7 @@ HandleScrolling(SynapticsPrivate * priv, struct SynapticsHwState *hw,
     }
 
     if (priv->scroll.coast_speed_y) {
-        double dtime = (hw->millis - priv->scroll.last_millis) / 1000.0;
+        double dtime = (INT64) (hw->usec - priv->scroll.last_usec) / 1000000.0;
         double ddy = para->coasting_friction * dtime;
 
         priv->scroll.delta_y += priv->scroll.coast_speed_y * dtime * abs(para->scroll_dist_vert);
@@ -2624,7 +3723,7 @@ HandleScrolling(SynapticsPrivate * priv, struct SynapticsHwState *hw,
     }
 
     if (priv->scroll.coast_speed_x) {
-        double dtime = (hw->millis - priv->scroll.last_millis) / 1000.0;
+        double dtime = (INT64) (hw->usec - priv->scroll.last_usec) / 1000000.0;
         double ddx = para->coasting_friction * dtime;
         priv->scroll.delta_x += priv->scroll.coast_speed_x * dtime * abs(para->scroll_dist_horiz);
         delay = MIN(delay, POLL_MS);
@@ -2641,61 +3740,203 @@ HandleScrolling(SynapticsPrivate * priv, struct SynapticsHwState *hw,
     return delay;
 }
 
-/**
- * Check if any 2+ fingers are close enough together to assume this is a
- * ClickFinger action.
+static void
+gesture_action(SynapticsPrivate * priv, int action)
+{
+    SynapticsParameters *para = &priv->synpara;
+
+    switch (action) {
+    case GESTURE_SCROLL_UP:
+        priv->scroll.delta_y -= para->scroll_dist_vert;
+        break;
+    case GESTURE_SCROLL_DOWN:
+        priv->scroll.delta_y += para->scroll_dist_vert;
+        break;
+    case GESTURE_SCROLL_LEFT:
+        priv->scroll.delta_x -= para->scroll_dist_horiz;
+        break;
+    case GESTURE_SCROLL_RIGHT:
+        priv->scroll.delta_x += para->scroll_dist_horiz;
+        break;
+    default:
+        if (action > 0)
+            priv->gesture.button = MIN(action, SYN_MAX_BUTTONS);
+        break;
+    }
+}
+
+/* Does the number of touches leave room for a swipe the user asked for? */
+static Bool
+swipe_configured(const SynapticsParameters * para, int fingers)
+{
+    int first;
+
+    if (fingers == 3)
+        first = SWIPE3_LEFT;
+    else if (fingers == 4)
+        first = SWIPE4_LEFT;
+    else
+        return FALSE;
+
+    return para->gesture_action[first] || para->gesture_action[first + 1] ||
+        para->gesture_action[first + 2] || para->gesture_action[first + 3];
+}
+
+/*
+ * Recognise swipes, pinches and rotations from the touch positions. A
+ * gesture starts whenever the number of touches changes. Swipes are
+ * reported once per gesture on the dominant axis of the centroid's travel;
+ * pinches and rotations are reported every time the spread or angle has
+ * changed by the threshold since the last report.
+ *
+ * Returns TRUE if the pointer should not move in this frame.
  */
-static int
-clickpad_guess_clickfingers(SynapticsPrivate * priv,
-                            struct SynapticsHwState *hw)
+static Bool
+HandleGestures(SynapticsPrivate * priv, struct SynapticsHwState *hw)
 {
-    int nfingers = 0;
-    uint32_t close_point = 0; /* 1 bit for each point close to another one */
-    int i, j;
+    SynapticsParameters *para = &priv->synpara;
+    SynapticsGestureTouchRec *prev = priv->gesture_touch;
+    struct TouchGeometry g;
+    double cx = 0, cy = 0, spread = 0, dangle = 0;
+    int num_slots = MIN(hw->num_mt_mask, SYNAPTICS_MASK_TOUCHES);
+    int n, i, common = 0;
+    int event = -1;
 
-    BUG_RETURN_VAL(hw->num_mt_mask > sizeof(close_point) * 8, 0);
+    priv->gesture.button = 0;
 
-    for (i = 0; i < hw->num_mt_mask - 1; i++) {
-        ValuatorMask *f1;
+    if (!priv->has_touch || priv->has_semi_mt || priv->direct_touch || !prev)
+        return FALSE;
 
-        if (hw->slot_state[i] == SLOTSTATE_EMPTY ||
-            hw->slot_state[i] == SLOTSTATE_CLOSE)
-            continue;
+    touch_geometry(priv, hw, &g);
+    n = popcount32(g.active);
+
+    if (n < 2) {
+        priv->gesture.fingers = 0;
+        priv->gesture.active = 0;
+        if (n == 0)
+            priv->gesture.fired = FALSE;
+        /* Don't let the last finger of a gesture move the pointer */
+        return priv->gesture.fired;
+    }
+
+    for (i = 0; i < num_slots; i++) {
+        if (g.active & (1U << i)) {
+            cx += hw->touch_x[i];
+            cy += hw->touch_y[i];
+        }
+    }
+    cx /= n;
+    cy /= n;
 
-        f1 = hw->mt_mask[i];
+    for (i = 0; i < num_slots; i++) {
+        double x, y, px, py;
 
-        for (j = i + 1; j < hw->num_mt_mask; j++) {
-            ValuatorMask *f2;
-            double x1, x2, y1, y2;
+        if (!(g.active & (1U << i)))
+            continue;
 
-            if (hw->slot_state[j] == SLOTSTATE_EMPTY ||
-                hw->slot_state[j] == SLOTSTATE_CLOSE)
-                continue;
+        x = hw->touch_x[i] - cx;
+        y = hw->touch_y[i] - cy;
+        spread += sqrt(x * x + y * y);
 
-            f2 = hw->mt_mask[j];
+        if (!(priv->gesture.active & (1U << i)))
+            continue;
 
-            x1 = valuator_mask_get_double(f1, 0);
-            y1 = valuator_mask_get_double(f1, 1);
+        /* Angle this touch turned around the centroid since last frame */
+        px = prev[i].x - priv->gesture.cx;
+        py = prev[i].y - priv->gesture.cy;
+        dangle += atan2(px * y - py * x, px * x + py * y);
+        common++;
+    }
+    spread /= n;
+
+    if (n != priv->gesture.fingers) {
+        priv->gesture.fingers = n;
+        priv->gesture.cx0 = cx;
+        priv->gesture.cy0 = cy;
+        priv->gesture.spread0 = spread;
+        priv->gesture.angle = 0;
+        priv->gesture.swiped = FALSE;
+    }
+    else {
+        /* Two fingers belong to scrolling if it is on */
+        Bool twofinger = (n > 2 || !(priv->vert_scroll_twofinger_on ||
+                                     priv->horiz_scroll_twofinger_on));
+
+        if (common)
+            priv->gesture.angle += dangle / common;
+
+        if (twofinger && para->gesture_pinch_ratio > 0 &&
+            priv->gesture.spread0 > 0) {
+            if (spread * 100 >=
+                priv->gesture.spread0 * (100 + para->gesture_pinch_ratio))
+                event = PINCH_OUT;
+            else if (spread * (100 + para->gesture_pinch_ratio) <=
+                     priv->gesture.spread0 * 100)
+                event = PINCH_IN;
+        }
 
-            x2 = valuator_mask_get_double(f2, 0);
-            y2 = valuator_mask_get_double(f2, 1);
+        if (event < 0 && twofinger && para->gesture_rotate_angle > 0 &&
+            fabs(priv->gesture.angle) >=
+            para->gesture_rotate_angle * M_PI / 180)
+            /* y grows downwards, so a positive angle is clockwise */
+            event = priv->gesture.angle > 0 ? ROTATE_RIGHT : ROTATE_LEFT;
 
-            /* FIXME: fingers closer together than 30% of touchpad width, but
-             * really, this should be dependent on the touchpad size. Also,
-             * you'll need to find a touchpad that doesn't lie about it's
-             * size. Good luck. */
-            if (abs(x1 - x2) < (priv->maxx - priv->minx) * .3 &&
-                abs(y1 - y2) < (priv->maxy - priv->miny) * .3) {
-                close_point |= (1 << j);
-                close_point |= (1 << i);
+        if (event >= 0 && para->gesture_action[event]) {
+            priv->gesture.spread0 = spread;
+            priv->gesture.angle = 0;
+        }
+        else
+            event = -1;
+
+        if (event < 0 && !priv->gesture.swiped &&
+            para->gesture_swipe_dist > 0 && swipe_configured(para, n)) {
+            double dx = cx - priv->gesture.cx0;
+            double dy = cy - priv->gesture.cy0;
+            int first = (n == 3) ? SWIPE3_LEFT : SWIPE4_LEFT;
+
+            if (fabs(dx) >= para->gesture_swipe_dist ||
+                fabs(dy) >= para->gesture_swipe_dist) {
+                if (fabs(dx) >= fabs(dy))
+                    event = first + (dx < 0 ? 0 : 1);
+                else
+                    event = first + (dy < 0 ? 2 : 3);
+                priv->gesture.swiped = TRUE;
             }
         }
+
+        if (event >= 0) {
+            DBG(7, "gesture %d\n", event);
+            gesture_action(priv, para->gesture_action[event]);
+            priv->gesture.fired = TRUE;
+        }
     }
 
-    while (close_point > 0) {
-        nfingers += close_point & 0x1;
-        close_point >>= 1;
+    for (i = 0; i < num_slots; i++) {
+        if (g.active & (1U << i)) {
+            prev[i].x = hw->touch_x[i];
+            prev[i].y = hw->touch_y[i];
+        }
     }
+    priv->gesture.active = g.active;
+    priv->gesture.cx = cx;
+    priv->gesture.cy = cy;
+
+    return priv->gesture.fired || swipe_configured(para, n);
+}
+
+/**
+ * Check if any 2+ fingers are close enough together to assume this is a
+ * ClickFinger action.
+ */
+static int
+clickpad_guess_clickfingers(SynapticsPrivate * priv,
+                            struct SynapticsHwState *hw)
+{
+    struct TouchGeometry g;
+    int nfingers;
+
+    touch_geometry(priv, hw, &g);
+    nfingers = popcount32(g.close_point);
 
     /* Some trackpads touchpad only track two touchpoints but announce
      * BTN_TOOL_TRIPLETAP (which sets hw->numFingers to 3), when this happens
@@ -2860,25 +4101,107 @@ post_button_click(const InputInfoPtr pInfo, const int button)
     xf86PostButtonEvent(pInfo->dev, FALSE, button, FALSE, 0, 0);
 }
 
+/*
+ * Frame builder: all valuator changes of one HandleState() call are
+ * collected in priv->events_mask and posted as a single motion event.
+ * Button events are posted after the motion so clients never see the
+ * buttons change at a stale position.
+ */
 static void
-post_scroll_events(const InputInfoPtr pInfo)
+queue_motion(SynapticsPrivate * priv, int x, int y)
 {
-    SynapticsPrivate *priv = (SynapticsPrivate *) (pInfo->private);
+    valuator_mask_set(priv->events_mask, 0, x);
+    valuator_mask_set(priv->events_mask, 1, y);
+}
+
+/* Pressure and contact size normalised to the valuator range, zero once
+ * the finger is lifted */
+static void
+queue_pressure(SynapticsPrivate * priv, const struct SynapticsHwState *hw,
+               Bool touching)
+{
+    int pressure = 0, width = 0;
+
+    if (priv->pressure.axis < 0 || (!touching && !priv->pressure.down))
+        return;
+
+    if (touching) {
+        int z = MAX(MIN(hw->z, priv->maxp), priv->minp);
+
+        pressure = priv->pressure.table[(z - priv->minp) *
+                                        (PRESSURE_TABLE_SIZE - 1) /
+                                        (priv->maxp - priv->minp)];
+        if (priv->pressure.width_axis >= 0) {
+            int w = MAX(MIN(hw->fingerWidth, priv->maxw), priv->minw);
+
+            width = (w - priv->minw) * PRESSURE_AXIS_MAX /
+                (priv->maxw - priv->minw);
+        }
+    }
 
-    valuator_mask_zero(priv->scroll_events_mask);
+    valuator_mask_set(priv->events_mask, priv->pressure.axis, pressure);
+    if (priv->pressure.width_axis >= 0)
+        valuator_mask_set(priv->events_mask, priv->pressure.width_axis,
+                          width);
+    priv->pressure.down = (pressure != 0);
+}
 
+static void
+queue_scroll_events(SynapticsPrivate * priv)
+{
     if (priv->scroll.delta_y != 0.0) {
-        valuator_mask_set_double(priv->scroll_events_mask,
+        valuator_mask_set_double(priv->events_mask,
                                  priv->scroll_axis_vert, priv->scroll.delta_y);
         priv->scroll.delta_y = 0;
     }
     if (priv->scroll.delta_x != 0.0) {
-        valuator_mask_set_double(priv->scroll_events_mask,
+        valuator_mask_set_double(priv->events_mask,
                                  priv->scroll_axis_horiz, priv->scroll.delta_x);
         priv->scroll.delta_x = 0;
     }
-    if (valuator_mask_num_valuators(priv->scroll_events_mask))
-        xf86PostMotionEventM(pInfo->dev, FALSE, priv->scroll_events_mask);
+}
+
+static void
+post_queued_events(const InputInfoPtr pInfo, Bool absolute)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) (pInfo->private);
+    ValuatorMask *mask = priv->events_mask;
+
+    if (valuator_mask_num_valuators(mask) == 0)
+        return;
+
+    /* Scroll valuators are always relative; an absolute frame that also
+     * scrolls needs a second, relative event for the scroll axes. */
+    if (absolute && (valuator_mask_isset(mask, 0) ||
+                     (priv->pressure.axis >= 0 &&
+                      valuator_mask_isset(mask, priv->pressure.axis)))) {
+        double hscroll = 0, vscroll = 0;
+        Bool has_hscroll, has_vscroll;
+
+        has_hscroll = valuator_mask_fetch_double(mask, priv->scroll_axis_horiz,
+                                                 &hscroll);
+        has_vscroll = valuator_mask_fetch_double(mask, priv->scroll_axis_vert,
+                                                 &vscroll);
+        if (has_hscroll || has_vscroll) {
+            valuator_mask_unset(mask, priv->scroll_axis_horiz);
+            valuator_mask_unset(mask, priv->scroll_axis_vert);
+            xf86PostMotionEventM(pInfo->dev, TRUE, mask);
+
+            valuator_mask_zero(mask);
+            if (has_hscroll)
+                valuator_mask_set_double(mask, priv->scroll_axis_horiz,
+                                         hscroll);
+            if (has_vscroll)
+                valuator_mask_set_double(mask, priv->scroll_axis_vert,
+                                         vscroll);
+        }
+        absolute = !(has_hscroll || has_vscroll);
+    }
+    else
+        absolute = FALSE;
+
+    xf86PostMotionEventM(pInfo->dev, absolute, mask);
+    valuator_mask_zero(mask);
 }
 
 static inline int
@@ -2941,54 +4264,103 @@ repeat_scrollbuttons(const InputInfoPtr pInfo,
     return delay;
 }
 
-/* Update the open slots and number of active touches */
+/*
+ * Open touches are kept in open_slots[0..num_active_touches - 1], and
+ * slot_index maps a slot back to its position in that array. Opening,
+ * closing and looking up a slot are all constant time; closing moves the
+ * last open slot into the hole.
+ */
+static void
+open_touch_slot(SynapticsPrivate * priv, int slot)
+{
+    BUG_RETURN(priv->slot_index[slot] != -1);
+    BUG_RETURN(priv->num_active_touches >= priv->num_slots);
+
+    priv->slot_index[slot] = priv->num_active_touches;
+    priv->open_slots[priv->num_active_touches++] = slot;
+}
+
+static void
+close_touch_slot(SynapticsPrivate * priv, int slot)
+{
+    int idx = priv->slot_index[slot];
+    int last;
+
+    BUG_RETURN(idx == -1);
+
+    last = priv->open_slots[--priv->num_active_touches];
+    priv->open_slots[idx] = last;
+    priv->slot_index[last] = idx;
+    priv->open_slots[priv->num_active_touches] = -1;
+    priv->slot_index[slot] = -1;
+}
+
+/*
+ * Update the open slots and number of active touches. Only the open slots
+ * can close; new slots are only looked for when the frame opened any.
+ */
 static void
 UpdateTouchState(InputInfoPtr pInfo, struct SynapticsHwState *hw)
 {
     SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
+    int opened = hw->num_opened;
     int i;
 
-    for (i = 0; i < hw->num_mt_mask; i++) {
-        if (hw->slot_state[i] == SLOTSTATE_OPEN) {
-            priv->open_slots[priv->num_active_touches] = i;
-            priv->num_active_touches++;
-            BUG_WARN(priv->num_active_touches > priv->num_slots);
-        }
-        else if (hw->slot_state[i] == SLOTSTATE_CLOSE) {
-            Bool found = FALSE;
-            int j;
-
-            for (j = 0; j < priv->num_active_touches - 1; j++) {
-                if (priv->open_slots[j] == i)
-                    found = TRUE;
+    /* Backwards, closing moves the last open slot into the hole */
+    for (i = priv->num_active_touches - 1; i >= 0; i--) {
+        int slot = priv->open_slots[i];
 
-                if (found)
-                    priv->open_slots[j] = priv->open_slots[j + 1];
-            }
+        if (hw->slot_state[slot] == SLOTSTATE_CLOSE)
+            close_touch_slot(priv, slot);
+    }
 
-            BUG_WARN(priv->num_active_touches == 0);
-            if (priv->num_active_touches > 0)
-                priv->num_active_touches--;
+    for (i = 0; opened > 0 && i < hw->num_mt_mask; i++) {
+        if (hw->slot_state[i] == SLOTSTATE_OPEN) {
+            open_touch_slot(priv, i);
+            opened--;
         }
     }
 
     SynapticsResetTouchHwState(hw, FALSE);
 }
 
+/*
+ * Post the contacts of this frame as XI2 touch events. The slot number is
+ * used as touch id, the server emulates the pointer from the first touch.
+ */
 static void
-HandleTouches(InputInfoPtr pInfo, struct SynapticsHwState *hw)
+post_touch_events(InputInfoPtr pInfo, struct SynapticsHwState *hw)
 {
-    SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
-    int new_active_touches = priv->num_active_touches;
     int i;
 
-    /* Count new number of active touches */
     for (i = 0; i < hw->num_mt_mask; i++) {
-        if (hw->slot_state[i] == SLOTSTATE_OPEN)
-            new_active_touches++;
-        else if (hw->slot_state[i] == SLOTSTATE_CLOSE)
-            new_active_touches--;
+        uint16_t type;
+
+        switch (hw->slot_state[i]) {
+        case SLOTSTATE_OPEN:
+            type = XI_TouchBegin;
+            break;
+        case SLOTSTATE_UPDATE:
+            type = XI_TouchUpdate;
+            break;
+        case SLOTSTATE_CLOSE:
+            type = XI_TouchEnd;
+            break;
+        default:
+            continue;
+        }
+
+        xf86PostTouchEvent(pInfo->dev, i, type, 0, hw->mt_mask[i]);
     }
+}
+
+static void
+HandleTouches(InputInfoPtr pInfo, struct SynapticsHwState *hw)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) (pInfo->private);
+
+    if (priv->direct_touch)
+        post_touch_events(pInfo, hw);
 
     UpdateTouchState(pInfo, hw);
 }
@@ -3004,6 +4376,74 @@ filter_jitter(SynapticsPrivate * priv, int *x, int *y)
     *y = priv->hyst_center_y;
 }
 
+/*
+ * Pen-like absolute mode: a finger in proximity hovers, a finger on the pad
+ * is in contact. Devices with a distance axis report both directly; on
+ * others a finger sensed below the SynapticsDetectFinger() thresholds
+ * hovers and a detected finger is in contact.
+ */
+static void
+detect_hover(const SynapticsPrivate * priv, const struct SynapticsHwState *hw,
+             enum FingerState finger, Bool *hover, Bool *contact)
+{
+    if (finger == FS_BLOCKED) {
+        *hover = *contact = FALSE;
+    }
+    else if (priv->has_distance) {
+        Bool proximity = hw->numFingers > 0;
+
+        *hover = proximity && hw->distance > 0;
+        *contact = proximity && hw->distance == 0;
+    }
+    else {
+        *contact = finger >= FS_TOUCHED;
+        *hover = !*contact && (hw->z > 0 || hw->numFingers > 0);
+    }
+}
+
+/*
+ * Pick the report rate for the next frames. With the adaptive policy the
+ * device runs at the high rate while a finger moves and RATE_HOLD_TIME
+ * after, and all the time a finger is in proximity in absolute mode. A
+ * resting finger gets the low rate. Protocols that lose packets on every
+ * switch stay at the high rate instead.
+ */
+static void
+update_report_rate(InputInfoPtr pInfo, const struct SynapticsHwState *hw,
+                   enum FingerState finger, Bool absolute, Bool proximity,
+                   CARD32 now)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) (pInfo->private);
+    Bool high;
+
+    if (!priv->proto_ops->SetReportRate || priv->comm.replay)
+        return;
+
+    if (finger >= FS_TOUCHED &&
+        (hw->x != priv->rate.last_x || hw->y != priv->rate.last_y))
+        priv->rate.last_motion = now;
+    priv->rate.last_x = hw->x;
+    priv->rate.last_y = hw->y;
+
+    switch (priv->synpara.report_rate) {
+    case RATE_LOW:
+        high = FALSE;
+        break;
+    case RATE_ADAPTIVE:
+        high = !priv->proto_ops->adaptive_rate || (absolute && proximity) ||
+            TIME_DIFF(priv->rate.last_motion + RATE_HOLD_TIME, now) > 0;
+        break;
+    default:
+        high = TRUE;
+        break;
+    }
+
+    /* A busy device refuses, try again with the next frame */
+    if (high != priv->rate.high &&
+        priv->proto_ops->SetReportRate(pInfo, high))
+        priv->rate.high = high;
+}
+
 static void
 reset_hw_state(struct SynapticsHwState *hw)
 {
@@ -3014,6 +4454,29 @@ reset_hw_state(struct SynapticsHwState *hw)
     hw->fingerWidth = 0;
 }
 
+/*
+ * Features HandleState() has to check for. Each variant below is compiled
+ * with a constant set of them, so the checks for features a variant leaves
+ * out are folded away. A feature in the set is still tested at runtime.
+ */
+enum HandleStateFeature {
+    HS_CLICKPAD = (1 << 0),     /* para->clickpad */
+    HS_SCROLLBUTTONS = (1 << 1),        /* priv->has_scrollbuttons */
+    HS_ABSOLUTE = (1 << 2),     /* priv->absolute_events or an absolute zone */
+    HS_TOUCH = (1 << 3),        /* priv->has_touch */
+    HS_ALL = HS_CLICKPAD | HS_SCROLLBUTTONS | HS_ABSOLUTE | HS_TOUCH
+};
+
+#define HS_FEATURE(f, cond) ((features & (f)) && (cond))
+
+/* The folding needs HandleState inlined into every variant, plain inline
+ * leaves that to the compiler's size heuristics */
+#if defined(__GNUC__)
+#define HS_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define HS_ALWAYS_INLINE inline
+#endif
+
 /*
  * React on changes in the hardware state. This function is called every time
  * the hardware state changes. The return value is used to specify how many
@@ -3023,10 +4486,12 @@ reset_hw_state(struct SynapticsHwState *hw)
  * from_timer denotes if HandleState was triggered from a timer (e.g. to
  * generate fake motion events, or for the tap-to-click state machine), rather
  * than from having received a motion event.
+ *
+ * Only called through the HandleState variants, with a constant features.
  */
-static int
+static HS_ALWAYS_INLINE int
 HandleState(InputInfoPtr pInfo, struct SynapticsHwState *hw, CARD32 now,
-            Bool from_timer)
+            Bool from_timer, const unsigned int features)
 {
     SynapticsPrivate *priv = (SynapticsPrivate *) (pInfo->private);
     SynapticsParameters *para = &priv->synpara;
@@ -3038,15 +4503,16 @@ HandleState(InputInfoPtr pInfo, struct SynapticsHwState *hw, CARD32 now,
     int delay = 1000000000;
     int timeleft;
     Bool inside_active_area;
-    Bool using_cumulative_coords = FALSE;
     Bool ignore_motion;
+    Bool absolute;
+    Bool hover = FALSE, contact = FALSE;
 
     /* We need both and x/y, the driver can't handle just one of the two
      * yet. But since it's possible to hit a phys button on non-clickpads
      * without ever getting motion data first, we must continue with 0/0 for
      * that case. */
     if (hw->x == INT_MIN || hw->y == INT_MAX) {
-        if (para->clickpad)
+        if (HS_FEATURE(HS_CLICKPAD, para->clickpad))
             return delay;
         else if (hw->left || hw->right || hw->middle) {
             hw->x = (hw->x == INT_MIN) ? 0 : hw->x;
@@ -3054,15 +4520,15 @@ HandleState(InputInfoPtr pInfo, struct SynapticsHwState *hw, CARD32 now,
         }
     }
 
-    /* If a physical button is pressed on a clickpad or a two-finger scrolling
-     * is ongoing, use cumulative relative touch movements for motion */
-    if (para->clickpad &&
-        ((priv->lastButtons & 7) ||
-        (priv->vert_scroll_twofinger_on || priv->horiz_scroll_twofinger_on)) &&
-        priv->last_button_area != TOP_BUTTON_AREA) {
-        hw->x = hw->cumulative_dx;
-        hw->y = hw->cumulative_dy;
-        using_cumulative_coords = TRUE;
+    if (HS_FEATURE(HS_TOUCH, priv->has_touch)) {
+        /* Leave palms and thumbs out of everything below */
+        classify_touches(priv, hw, now);
+
+        /* On clickpads, follow one touch instead of the kernel's pointer
+         * emulation, so fingers landing or lifting don't make the cursor
+         * jump */
+        if (HS_FEATURE(HS_CLICKPAD, para->clickpad))
+            update_pointer_slot(priv, hw);
     }
 
     /* apply hysteresis before doing anything serious. This cancels
@@ -3072,9 +4538,14 @@ HandleState(InputInfoPtr pInfo, struct SynapticsHwState *hw, CARD32 now,
 
     inside_active_area = is_inside_active_area(priv, hw->x, hw->y);
 
-    /* Ignore motion *starting* inside softbuttonareas */
-    if (priv->finger_state < FS_TOUCHED)
+    if (priv->finger_state < FS_TOUCHED) {
+        /* Ignore motion *starting* inside softbuttonareas */
         priv->last_button_area = current_button_area(para, hw->x, hw->y);
+        /* The zone of the touch-down decides absolute or relative output
+         * until the finger lifts */
+        if (features & HS_ABSOLUTE)
+            priv->zone_touch = is_inside_absolute_zone(para, hw->x, hw->y);
+    }
     /* If we already have a finger down, clear last_button_area if it goes
        outside of the softbuttonareas */
     else if (priv->last_button_area != NO_BUTTON_AREA &&
@@ -3082,15 +4553,17 @@ HandleState(InputInfoPtr pInfo, struct SynapticsHwState *hw, CARD32 now,
         priv->last_button_area = NO_BUTTON_AREA;
 
     ignore_motion = para->touchpad_off == TOUCHPAD_OFF ||
-        (!using_cumulative_coords && priv->last_button_area != NO_BUTTON_AREA);
+        priv->last_button_area != NO_BUTTON_AREA;
+    absolute = HS_FEATURE(HS_ABSOLUTE, priv->absolute_events ||
+                          priv->zone_touch);
 
     /* these two just update hw->left, right, etc. */
     update_hw_button_state(pInfo, hw, now, &delay);
-    if (priv->has_scrollbuttons)
+    if (HS_FEATURE(HS_SCROLLBUTTONS, priv->has_scrollbuttons))
         double_click = adjust_state_from_scrollbuttons(pInfo, hw);
 
     /* Ignore motion the first X ms after a clickpad click */
-    if (priv->clickpad_click_millis) {
+    if (HS_FEATURE(HS_CLICKPAD, priv->clickpad_click_millis)) {
         if(TIME_DIFF(priv->clickpad_click_millis +
                      para->clickpad_ignore_motion_time, now) > 0)
             ignore_motion = TRUE;
@@ -3114,9 +4587,21 @@ HandleState(InputInfoPtr pInfo, struct SynapticsHwState *hw, CARD32 now,
             finger = priv->finger_state;
     }
 
+    /* In direct touch mode the contacts are reported as touches and the
+     * server drives the pointer, so the finger takes no part in motion,
+     * tapping or scrolling here. */
+    if (HS_FEATURE(HS_TOUCH, priv->direct_touch))
+        finger = FS_UNTOUCHED;
+
+    /* With absolute hover, contact is the click and tapping is off */
+    if (absolute && para->absolute_hover && inside_active_area)
+        detect_hover(priv, hw, finger, &hover, &contact);
+
     /* tap and drag detection. Needs to be performed even if the finger is in
      * the dead area to reset the state. */
-    timeleft = HandleTapProcessing(priv, hw, now, finger, inside_active_area);
+    timeleft = HandleTapProcessing(priv, hw, now,
+                                   (absolute && para->absolute_hover) ?
+                                   FS_UNTOUCHED : finger, inside_active_area);
     if (timeleft > 0)
         delay = MIN(delay, timeleft);
 
@@ -3126,19 +4611,36 @@ HandleState(InputInfoPtr pInfo, struct SynapticsHwState *hw, CARD32 now,
         if (timeleft > 0)
             delay = MIN(delay, timeleft);
 
+        if (HS_FEATURE(HS_TOUCH, !from_timer) && HandleGestures(priv, hw))
+            ignore_motion = TRUE;
+
         /*
          * Compensate for unequal x/y resolution. This needs to be done after
          * calculations that require unadjusted coordinates, for example edge
          * detection.
          */
+        if (HS_FEATURE(HS_ABSOLUTE, priv->zone_touch))
+            map_absolute_zone(priv, hw);
+        else if (absolute) {
+            if (para->calib_learn && finger >= FS_TOUCHED)
+                learn_calibration(pInfo, hw);
+            if (priv->calib.active)
+                apply_calibration(priv, hw);
+#ifndef NO_DRIVER_SCALING
+            else
+                ScaleCoordinates(priv, hw);
+#endif
+        }
+        else {
 #ifndef NO_DRIVER_SCALING
-        ScaleCoordinates(priv, hw);
+            ScaleCoordinates(priv, hw);
 #endif
+        }
     }
 
     dx = dy = 0;
 
-    if(!priv->absolute_events) {
+    if (!absolute) {
         timeleft = ComputeDeltas(priv, hw, edge, &dx, &dy, inside_active_area);
         delay = MIN(delay, timeleft);
     }
@@ -3153,15 +4655,35 @@ HandleState(InputInfoPtr pInfo, struct SynapticsHwState *hw, CARD32 now,
     if (priv->tap_button > 0 && priv->tap_button_state == TBS_BUTTON_DOWN)
         buttons |= 1 << (priv->tap_button - 1);
 
-    /* Post events */
-    if (finger >= FS_TOUCHED) {
-        if (priv->absolute_events && inside_active_area) {
-            xf86PostMotionEvent(pInfo->dev, 1, 0, 2, hw->x, hw->y);
-        }else if( (dx || dy ) && !ignore_motion) {
-            xf86PostMotionEvent(pInfo->dev, 0, 0, 2, dx, dy);
-        }
+    if (contact)
+        buttons |= 0x01;
+
+    /* Build the frame: pointer motion and scrolling share one event */
+    valuator_mask_zero(priv->events_mask);
+    update_accel_pressure(priv, hw);
+
+    if (finger >= FS_TOUCHED || hover || contact) {
+        if (absolute && inside_active_area)
+            queue_motion(priv, hw->x, hw->y);
+        else if ((dx || dy) && !ignore_motion)
+            queue_motion(priv, dx, dy);
+    }
+
+    if (absolute && inside_active_area)
+        queue_pressure(priv, hw, finger >= FS_TOUCHED);
+
+    /* Process scroll events only if coordinates are
+     * in the Synaptics Area
+     */
+    if (inside_active_area &&
+        (priv->scroll.delta_x != 0.0 || priv->scroll.delta_y != 0.0)) {
+        queue_scroll_events(priv);
+        priv->scroll.last_usec = hw->usec;
     }
 
+    post_queued_events(pInfo, absolute && inside_active_area);
+
+    /* Buttons go after the motion */
     if (priv->mid_emu_state == MBE_LEFT_CLICK) {
         post_button_click(pInfo, 1);
         priv->mid_emu_state = MBE_OFF;
@@ -3171,6 +4693,11 @@ HandleState(InputInfoPtr pInfo, struct SynapticsHwState *hw, CARD32 now,
         priv->mid_emu_state = MBE_OFF;
     }
 
+    if (priv->gesture.button) {
+        post_button_click(pInfo, priv->gesture.button);
+        priv->gesture.button = 0;
+    }
+
     change = buttons ^ priv->lastButtons;
     while (change) {
         id = ffs(change);       /* number of first set bit 1..32 is returned */
@@ -3179,16 +4706,16 @@ HandleState(InputInfoPtr pInfo, struct SynapticsHwState *hw, CARD32 now,
                             0, 0);
     }
 
-    if (priv->has_scrollbuttons)
+    /* Repeated scroll buttons scroll after the buttons, in their own event */
+    if (HS_FEATURE(HS_SCROLLBUTTONS, priv->has_scrollbuttons)) {
         delay = repeat_scrollbuttons(pInfo, hw, buttons, now, delay);
-
-    /* Process scroll events only if coordinates are
-     * in the Synaptics Area
-     */
-    if (inside_active_area &&
-        (priv->scroll.delta_x != 0.0 || priv->scroll.delta_y != 0.0)) {
-        post_scroll_events(pInfo);
-        priv->scroll.last_millis = hw->millis;
+        if (inside_active_area &&
+            (priv->scroll.delta_x != 0.0 || priv->scroll.delta_y != 0.0)) {
+            valuator_mask_zero(priv->events_mask);
+            queue_scroll_events(priv);
+            priv->scroll.last_usec = hw->usec;
+            post_queued_events(pInfo, FALSE);
+        }
     }
 
     if (double_click) {
@@ -3198,17 +4725,77 @@ HandleState(InputInfoPtr pInfo, struct SynapticsHwState *hw, CARD32 now,
 
     HandleTouches(pInfo, hw);
 
+    update_report_rate(pInfo, hw, finger, absolute,
+                       finger >= FS_TOUCHED || hover || contact, now);
+
     /* Save old values of some state variables */
     priv->finger_state = finger;
     priv->lastButtons = buttons;
 
     /* generate a history of the absolute positions */
     if (inside_active_area)
-        store_history(priv, hw->x, hw->y, hw->millis);
+        store_history(priv, hw->x, hw->y, hw->usec);
 
     return delay;
 }
 
+#define HANDLE_STATE_VARIANT(name, features)                            \
+static int                                                              \
+name(InputInfoPtr pInfo, struct SynapticsHwState *hw, CARD32 now,       \
+     Bool from_timer)                                                   \
+{                                                                       \
+    return HandleState(pInfo, hw, now, from_timer, features);           \
+}
+
+HANDLE_STATE_VARIANT(HandleStateGeneric, HS_ALL)
+HANDLE_STATE_VARIANT(HandleStateRelative, HS_TOUCH)
+HANDLE_STATE_VARIANT(HandleStateClickpad, HS_CLICKPAD | HS_TOUCH)
+HANDLE_STATE_VARIANT(HandleStateAbsolute, HS_ABSOLUTE | HS_TOUCH)
+HANDLE_STATE_VARIANT(HandleStateScrollButtons, HS_SCROLLBUTTONS)
+
+static const struct {
+    unsigned int features;
+    int (*handle_state) (InputInfoPtr, struct SynapticsHwState *, CARD32,
+                         Bool);
+    const char *name;
+} handle_state_variants[] = {
+    /* Smallest sets first, the first one covering the device wins */
+    {HS_SCROLLBUTTONS, HandleStateScrollButtons, "legacy scroll buttons"},
+    {HS_TOUCH, HandleStateRelative, "relative"},
+    {HS_CLICKPAD | HS_TOUCH, HandleStateClickpad, "relative clickpad"},
+    {HS_ABSOLUTE | HS_TOUCH, HandleStateAbsolute, "absolute"},
+    {HS_ALL, HandleStateGeneric, "generic"},
+};
+
+/*
+ * Pick the HandleState variant for the current configuration. Must be called
+ * whenever one of the HandleStateFeature conditions may have changed.
+ */
+void
+SynapticsSelectHandleState(SynapticsPrivate * priv)
+{
+    unsigned int features = 0;
+    int i;
+
+    if (priv->synpara.clickpad)
+        features |= HS_CLICKPAD;
+    if (priv->has_scrollbuttons)
+        features |= HS_SCROLLBUTTONS;
+    if (priv->absolute_events || has_absolute_zone(&priv->synpara))
+        features |= HS_ABSOLUTE;
+    if (priv->has_touch)
+        features |= HS_TOUCH;
+
+    for (i = 0; i < sizeof(handle_state_variants) /
+         sizeof(handle_state_variants[0]); i++)
+        if ((handle_state_variants[i].features & features) == features)
+            break;
+
+    if (priv->handle_state != handle_state_variants[i].handle_state)
+        DBG(3, "using the %s input path\n", handle_state_variants[i].name);
+    priv->handle_state = handle_state_variants[i].handle_state;
+}
+
 static int
 ControlProc(InputInfoPtr pInfo, xDeviceCtl * control)
 {
@@ -3237,6 +4824,8 @@ SwitchMode(ClientPtr client, DeviceIntPtr dev, int mode)
             
     }
 
+    SynapticsSelectHandleState(priv);
+
     return Success;
 }
 
@@ -3257,6 +4846,7 @@ QueryHardware(InputInfoPtr pInfo)
     SynapticsPrivate *priv = (SynapticsPrivate *) pInfo->private;
 
     priv->comm.protoBufTail = 0;
+    priv->comm.ringHead = priv->comm.ringTail = 0;
 
     if (!priv->proto_ops->QueryHardware(pInfo)) {
         xf86IDrvMsg(pInfo, X_PROBED, "no supported touchpad found\n");
@@ -3275,8 +4865,10 @@ ScaleCoordinates(SynapticsPrivate * priv, struct SynapticsHwState *hw)
     int xCenter = (priv->synpara.left_edge + priv->synpara.right_edge) / 2;
     int yCenter = (priv->synpara.top_edge + priv->synpara.bottom_edge) / 2;
 
-    hw->x = (hw->x - xCenter) * priv->horiz_coeff + xCenter;
-    hw->y = (hw->y - yCenter) * priv->vert_coeff + yCenter;
+    hw->x = ((INT64) (hw->x - xCenter) * priv->horiz_coeff +
+             (INT64) xCenter * Q16_ONE) / Q16_ONE;
+    hw->y = ((INT64) (hw->y - yCenter) * priv->vert_coeff +
+             (INT64) yCenter * Q16_ONE) / Q16_ONE;
 }
 
 void
@@ -3286,16 +4878,29 @@ CalculateScalingCoeffs(SynapticsPrivate * priv)
     int horizRes = priv->synpara.resolution_horiz;
 
     if ((horizRes > vertRes) && (horizRes > 0)) {
-        priv->horiz_coeff = vertRes / (double) horizRes;
-        priv->vert_coeff = 1;
+        priv->horiz_coeff = (INT64) vertRes * Q16_ONE / horizRes;
+        priv->vert_coeff = Q16_ONE;
     }
     else if ((horizRes < vertRes) && (vertRes > 0)) {
-        priv->horiz_coeff = 1;
-        priv->vert_coeff = horizRes / (double) vertRes;
+        priv->horiz_coeff = Q16_ONE;
+        priv->vert_coeff = (INT64) horizRes * Q16_ONE / vertRes;
     }
     else {
-        priv->horiz_coeff = 1;
-        priv->vert_coeff = 1;
+        priv->horiz_coeff = Q16_ONE;
+        priv->vert_coeff = Q16_ONE;
     }
 }
 #endif
+
+/* Precompute the weights of the maxDeltaMM test in exceeds_max_delta() */
+static void
+CalculateDeltaLimit(SynapticsPrivate * priv)
+{
+    const SynapticsParameters *para = &priv->synpara;
+    CARD64 limit = (CARD64) para->maxDeltaMM * para->resolution_horiz *
+        para->resolution_vert;
+
+    priv->delta_weight_x = (CARD64) para->resolution_vert * para->resolution_vert;
+    priv->delta_weight_y = (CARD64) para->resolution_horiz * para->resolution_horiz;
+    priv->max_delta = limit * limit;
+}
@@ -53,6 +53,15 @@
  *****************************************************************************/
 #define SYNAPTICS_MOVE_HISTORY	5
 #define SYNAPTICS_MAX_TOUCHES	10
+#define SYNAPTICS_MASK_TOUCHES	32      /* Touches the per-slot bit masks hold */
+#define SYNAPTICS_CACHE_LINE	64
+#define SYNAPTICS_HOT_LINES	16      /* Cache lines the per-frame state may use */
+
+#if defined(__GNUC__)
+#define SYNAPTICS_CACHE_ALIGNED __attribute__((aligned(SYNAPTICS_CACHE_LINE)))
+#else
+#define SYNAPTICS_CACHE_ALIGNED
+#endif
 #define SYN_MAX_BUTTONS 12      /* Max number of mouse buttons */
 
 /* Minimum and maximum values for scroll_button_repeat */
@@ -83,10 +92,61 @@ enum ClickFingerEvent {
     MAX_CLICK
 };
 
+enum GestureEvent {
+    SWIPE3_LEFT = 0,            /* Three fingers moving left */
+    SWIPE3_RIGHT,
+    SWIPE3_UP,
+    SWIPE3_DOWN,
+    SWIPE4_LEFT,                /* Four fingers moving left */
+    SWIPE4_RIGHT,
+    SWIPE4_UP,
+    SWIPE4_DOWN,
+    PINCH_IN,                   /* Fingers moving together */
+    PINCH_OUT,                  /* Fingers moving apart */
+    ROTATE_LEFT,                /* Fingers turning counter-clockwise */
+    ROTATE_RIGHT,               /* Fingers turning clockwise */
+    MAX_GESTURE
+};
+
+enum AccelProfile {
+    ACCEL_LINEAR = 0,           /* Speed grows linearly with velocity */
+    ACCEL_PIECEWISE,            /* Straight lines between AccelPoints */
+    ACCEL_SIGMOID,              /* Smooth S-curve from MinSpeed to MaxSpeed */
+    ACCEL_MAX_PROFILE = ACCEL_SIGMOID
+};
+
+enum ReportRate {
+    RATE_LOW = 0,               /* Always the low report rate */
+    RATE_HIGH,                  /* Always the high report rate */
+    RATE_ADAPTIVE,              /* High while moving or in absolute mode */
+    RATE_MAX = RATE_ADAPTIVE
+};
+
+#define RATE_HOLD_TIME 1000     /* ms without motion before the rate drops */
+
+#define ACCEL_MAX_POINTS 8      /* Points of the piecewise profile */
+#define ACCEL_TABLE_SIZE 256    /* Entries of the precomputed profile */
+
+#define Q16_ONE 65536           /* 1.0 in 16.16 fixed point */
+
+#define CALIB_GRID_SIZE 5       /* Nodes per side of the correction grid */
+#define CALIB_GRID_VALUES (2 * CALIB_GRID_SIZE * CALIB_GRID_SIZE)
+#define CALIB_PUBLISH_DELAY 2000        /* ms of stable learned values before
+                                           they are published */
+
+#define PRESSURE_TABLE_SIZE 256 /* Entries of the precomputed pressure curve */
+#define PRESSURE_AXIS_MAX 65535 /* Range of the exported pressure valuators */
+
+/* Gesture actions other than buttons */
+#define GESTURE_SCROLL_UP    -1
+#define GESTURE_SCROLL_DOWN  -2
+#define GESTURE_SCROLL_LEFT  -3
+#define GESTURE_SCROLL_RIGHT -4
+
 
 typedef struct _SynapticsMoveHist {
     int x, y;
-    CARD32 millis;
+    CARD64 usec;
 } SynapticsMoveHistRec;
 
 typedef struct _SynapticsTouchAxis {
@@ -96,6 +156,24 @@ typedef struct _SynapticsTouchAxis {
     int res;
 } SynapticsTouchAxisRec;
 
+enum TouchClass {
+    TC_UNDECIDED = 0,
+    TC_FINGER,
+    TC_THUMB,                   /* Note! The order matters. Thumbs and palms */
+    TC_PALM,                    /* are compared with >= TC_THUMB. */
+};
+
+typedef struct _SynapticsTouchClass {
+    enum TouchClass cls;        /* Cached decision, kept until release */
+    CARD32 start_millis;        /* Time of touch-down */
+    int start_x, start_y;       /* Position at touch-down */
+    Bool excluded;              /* Left out of the previous frame */
+} SynapticsTouchClassRec;
+
+typedef struct _SynapticsGestureTouch {
+    int x, y;                   /* Position in the previous frame */
+} SynapticsGestureTouchRec;
+
 enum FingerState {              /* Note! The order matters. Compared with < operator. */
     FS_BLOCKED = -1,
     FS_UNTOUCHED = 0,           /* this is 0 so it's the initialized value. */
@@ -189,6 +267,9 @@ typedef struct _SynapticsParameters {
     Bool scroll_twofinger_vert; /* Enable/disable vertical two-finger scrolling */
     Bool scroll_twofinger_horiz;        /* Enable/disable horizontal two-finger scrolling */
     double min_speed, max_speed, accl;  /* movement parameters */
+    int accel_profile;          /* enum AccelProfile */
+    int accel_num_points;       /* Points of the piecewise profile, 0 for default */
+    float accel_points[2 * ACCEL_MAX_POINTS];   /* velocity, factor pairs */
 
     Bool updown_button_scrolling;       /* Up/Down-Button scrolling or middle/double-click */
     Bool leftright_button_scrolling;    /* Left/right-button scrolling, or two lots of middle button */
@@ -210,6 +291,8 @@ typedef struct _SynapticsParameters {
     int circular_trigger;       /* Trigger area for circular scrolling */
     Bool circular_pad;          /* Edge has an oval or circular shape */
     Bool palm_detect;           /* Enable Palm Detection */
+    Bool absolute_hover;        /* Absolute mode: hover moves, contact clicks */
+    int report_rate;            /* Report rate policy, see enum ReportRate */
     int palm_min_width;         /* Palm detection width */
     int palm_min_z;             /* Palm detection depth */
     double coasting_speed;      /* Coasting threshold scrolling speed in scrolls/s */
@@ -223,85 +306,143 @@ typedef struct _SynapticsParameters {
     unsigned int resolution_horiz;      /* horizontal resolution of touchpad in units/mm */
     unsigned int resolution_vert;       /* vertical resolution of touchpad in units/mm */
     int area_left_edge, area_right_edge, area_top_edge, area_bottom_edge;       /* area coordinates absolute */
+    int abs_zone_left_edge, abs_zone_right_edge, abs_zone_top_edge, abs_zone_bottom_edge;       /* zone with absolute output */
     int softbutton_areas[4][4]; /* soft button area coordinates, 0 => right, 1 => middle , 2 => secondary right, 3 => secondary middle button */
     int hyst_x, hyst_y;         /* x and y width of hysteresis box */
 
     int maxDeltaMM;               /* maximum delta movement (vector length) in mm */
+    Bool record;                /* Record the raw input to RecordFile */
+    int gesture_action[MAX_GESTURE];    /* Action for each gesture, 0 is none */
+    int gesture_swipe_dist;     /* Centroid travel for a swipe, in device units */
+    int gesture_pinch_ratio;    /* Change in finger spread for a pinch, in percent */
+    int gesture_rotate_angle;   /* Rotation for a rotate gesture, in degrees */
+    int pressure_curve[4];      /* Bezier control points x1 y1 x2 y2, 0-100 */
+    Bool calib_learn;           /* Learn the reachable extents in absolute mode */
+    Bool calib_fit_grid;        /* Fit the correction grid while learning */
+    int calib_extents[4];       /* Reachable min x, max x, min y, max y, all 0
+                                   for the kernel ranges */
+    int calib_grid[CALIB_GRID_VALUES];  /* x, y offset at each grid node, row by row */
 } SynapticsParameters;
 
+/*
+ * The members are ordered by how often the input path touches them. The
+ * per-frame state comes first so it shares the first cache lines of the
+ * allocation, followed by the read-mostly geometry and parameters. Setup
+ * data, tables and rarely used state come last. Keep new fields in the
+ * matching group.
+ *
+ * The struct is allocated on a cache line boundary and the read-mostly
+ * group starts on a line of its own. SynapticsPreInit checks at compile
+ * time that the per-frame state fits in SYNAPTICS_HOT_LINES lines.
+ */
 struct _SynapticsPrivateRec {
-    SynapticsParameters synpara;        /* Default parameter settings, read from
-                                           the X config file */
-    struct SynapticsProtocolOperations *proto_ops;
-    void *proto_data;           /* protocol-specific data */
+    /* Per-frame state, read and written for every packet, from reading the
+     * device through HandleState(); the device ring buffer comes last */
 
+    /* HandleState variant for the current configuration */
+    int (*handle_state) (InputInfoPtr pInfo, struct SynapticsHwState *hw,
+                         CARD32 now, Bool from_timer);
     struct SynapticsHwState *hwState;
-
-    const char *device;         /* device node */
-    CARD32 timer_time;          /* when timer last fired */
-    OsTimerPtr timer;           /* for up/down-button repeat, tap processing, etc */
-
-    struct CommData comm;
-
     struct SynapticsHwState *local_hw_state;    /* used in place of local hw state variables */
-
-    Bool absolute_events; /* Keeps track of absolute/relative mode */
-
-    SynapticsMoveHistRec move_hist[SYNAPTICS_MOVE_HISTORY];     /* movement history */
+    ValuatorMask *events_mask;  /* Valuators accumulated for this frame */
+    enum FingerState finger_state;      /* previous finger state */
+    enum MovingState moving_state;      /* previous moving state */
+    enum TapState tap_state;    /* State of tap processing */
+    enum TapButtonState tap_button_state;       /* Current tap action */
+    enum MidButtonEmulation mid_emu_state;      /* emulated 3rd button */
+    enum SoftButtonAreas last_button_area;    /* Last button area we were in */
+    int lastButtons;            /* last state of the buttons */
+    int count_packet_finger;    /* packet counter with finger on the touchpad */
     int hist_index;             /* Last added entry in move_hist[] */
     int hyst_center_x;          /* center x of hysteresis */
     int hyst_center_y;          /* center y of hysteresis */
+    int prev_z;                 /* previous z value, for palm detection */
+    int prevFingers;            /* previous numFingers, for transition detection */
+    int avg_width;              /* weighted average of previous fingerWidth values */
+    int tap_max_fingers;        /* Max number of fingers seen since entering start state */
+    int tap_button;             /* Which button started the tap processing */
+    CARD32 tap_deadline;        /* Timeout of the current tap state */
+    CARD32 last_motion_millis;  /* time of the last motion */
+    int clickpad_click_millis;  /* Time of last clickpad click */
+    int button_delay_millis;    /* button delay for 3rd button emulation */
+    int repeatButtons;          /* buttons for repeat */
+    int nextRepeat;             /* Time when to trigger next auto repeat event */
+    int num_active_touches;     /* Number of active touches on device */
+    int pointer_slot;           /* Slot driving the pointer on clickpads, or -1 */
+    int finger_slot;            /* Slot giving the position while touches are
+                                   left out, or -1 */
+    Bool absolute_events; /* Keeps track of absolute/relative mode */
+    Bool zone_touch;            /* Current touch started in the absolute zone */
+    Bool prev_up;               /* Previous up button value, for double click emulation */
+    Bool vert_scroll_edge_on;   /* Keeps track of currently active scroll modes */
+    Bool horiz_scroll_edge_on;  /* Keeps track of currently active scroll modes */
+    Bool vert_scroll_twofinger_on;      /* Keeps track of currently active scroll modes */
+    Bool horiz_scroll_twofinger_on;     /* Keeps track of currently active scroll modes */
+    Bool circ_scroll_on;        /* Keeps track of currently active scroll modes */
+    Bool circ_scroll_vert;      /* True: Generate vertical scroll events
+                                   False: Generate horizontal events */
+    int frac_x, frac_y;         /* absolute -> relative fraction, Q16 */
+    CARD32 timer_time;          /* when timer last fired */
+    OsTimerPtr timer;           /* for up/down-button repeat, tap processing, etc */
+    double accel_pressure;      /* Pressure factor of the current frame */
+    struct {
+        Bool active;            /* Calibrated extents are set */
+        Bool grid;              /* Correction grid is not all zero */
+        double scale_x, scale_y;        /* Reachable extents to axis range */
+        double cell_inv_x, cell_inv_y;  /* Grid cells per device unit */
+    } calib;
+    struct {
+        Bool high;              /* The device runs at the high rate */
+        int last_x, last_y;     /* Position in the previous frame */
+        CARD32 last_motion;     /* Time the finger last moved */
+    } rate;
+    SynapticsMoveHistRec move_hist[SYNAPTICS_MOVE_HISTORY];     /* movement history */
+    struct {
+        int x, y;
+        CARD32 millis;
+    } touch_on;                 /* data when the touchpad is touched/released */
     struct {
         int last_x;             /* last x-scroll position */
         int last_y;             /* last y-scroll position */
         double delta_x;         /* accumulated horiz scroll delta */
         double delta_y;         /* accumulated vert scroll delta */
         double last_a;          /* last angle-scroll position */
-        CARD32 last_millis;     /* time last scroll event posted */
+        CARD64 last_usec;       /* time last scroll event posted */
         double coast_speed_x;   /* Horizontal coasting speed in scrolls/s */
         double coast_speed_y;   /* Vertical coasting speed in scrolls/s */
         double coast_delta_x;   /* Accumulated horizontal coast delta */
         double coast_delta_y;   /* Accumulated vertical coast delta */
         int packets_this_scroll;        /* Events received for this scroll */
     } scroll;
-    int count_packet_finger;    /* packet counter with finger on the touchpad */
-    int button_delay_millis;    /* button delay for 3rd button emulation */
-    Bool prev_up;               /* Previous up button value, for double click emulation */
-    enum FingerState finger_state;      /* previous finger state */
-    CARD32 last_motion_millis;  /* time of the last motion */
-    enum SoftButtonAreas last_button_area;    /* Last button area we were in */
-    int clickpad_click_millis;  /* Time of last clickpad click */
 
-    enum TapState tap_state;    /* State of tap processing */
-    int tap_max_fingers;        /* Max number of fingers seen since entering start state */
-    int tap_button;             /* Which button started the tap processing */
-    enum TapButtonState tap_button_state;       /* Current tap action */
-    SynapticsMoveHistRec touch_on;      /* data when the touchpad is touched/released */
+    struct {
+        int fingers;            /* Touches in the current gesture, 0 if none */
+        uint32_t active;        /* Slots that were active in the previous frame */
+        double cx0, cy0;        /* Centroid at the start of the gesture */
+        double spread0;         /* Mean finger distance from the centroid at start */
+        double cx, cy;          /* Centroid in the previous frame */
+        double angle;           /* Rotation since the start, in radians */
+        Bool swiped;            /* A swipe was reported in this gesture */
+        Bool fired;             /* Any gesture was reported since the first touch */
+        int button;             /* Button to click in this frame, or 0 */
+    } gesture;
 
-    enum MovingState moving_state;      /* previous moving state */
-    Bool vert_scroll_edge_on;   /* Keeps track of currently active scroll modes */
-    Bool horiz_scroll_edge_on;  /* Keeps track of currently active scroll modes */
-    Bool vert_scroll_twofinger_on;      /* Keeps track of currently active scroll modes */
-    Bool horiz_scroll_twofinger_on;     /* Keeps track of currently active scroll modes */
-    Bool circ_scroll_on;        /* Keeps track of currently active scroll modes */
-    Bool circ_scroll_vert;      /* True: Generate vertical scroll events
-                                   False: Generate horizontal events */
-    double frac_x, frac_y;      /* absolute -> relative fraction */
-    enum MidButtonEmulation mid_emu_state;      /* emulated 3rd button */
-    int repeatButtons;          /* buttons for repeat */
-    int nextRepeat;             /* Time when to trigger next auto repeat event */
-    int lastButtons;            /* last state of the buttons */
-    int prev_z;                 /* previous z value, for palm detection */
-    int prevFingers;            /* previous numFingers, for transition detection */
-    int avg_width;              /* weighted average of previous fingerWidth values */
-#ifndef NO_DRIVER_SCALING
-    double horiz_coeff;         /* normalization factor for x coordintes */
-    double vert_coeff;          /* normalization factor for y coordintes */
-#endif
+    struct CommData comm;
 
-    int minx, maxx, miny, maxy; /* min/max dimensions as detected */
+    /* Read-mostly geometry and capabilities */
+    int minx SYNAPTICS_CACHE_ALIGNED;   /* min/max dimensions as detected */
+    int maxx, miny, maxy;
     int minp, maxp, minw, maxw; /* min/max pressure and finger width as detected */
     int resx, resy;             /* resolution of coordinates as detected in units/mm */
+#ifndef NO_DRIVER_SCALING
+    int horiz_coeff;            /* normalization factor for x coordintes, Q16 */
+    int vert_coeff;             /* normalization factor for y coordintes, Q16 */
+#endif
+    CARD64 delta_weight_x;      /* resolution_vert squared, for the maxDeltaMM test */
+    CARD64 delta_weight_y;      /* resolution_horiz squared, for the maxDeltaMM test */
+    CARD64 max_delta;           /* maxDeltaMM scaled by both weights */
+    int scroll_axis_horiz;      /* Horizontal smooth-scrolling axis */
+    int scroll_axis_vert;       /* Vertical smooth-scrolling axis */
     Bool has_left;              /* left button detected for this device */
     Bool has_right;             /* right button detected for this device */
     Bool has_middle;            /* middle button detected for this device */
@@ -309,25 +450,56 @@ struct _SynapticsPrivateRec {
     Bool has_triple;            /* triple click detected for this device */
     Bool has_pressure;          /* device reports pressure */
     Bool has_width;             /* device reports finger width */
+    Bool has_distance;          /* device reports hover distance */
     Bool has_scrollbuttons;     /* device has physical scrollbuttons */
     Bool has_semi_mt;           /* device is only semi-multitouch capable */
     Bool has_mt_palm_detect;    /* device reports per finger width and pressure */
+    Bool has_touch;             /* Device has multitouch capabilities */
+    Bool direct_touch;          /* Touches are posted as XI2 direct touch events */
+    int num_slots;              /* Number of touch slots allocated */
+    int *open_slots;            /* Array of currently open touch slots */
+    int *slot_index;            /* Position of each slot in open_slots, or -1 */
+    SynapticsTouchClassRec *touch_class;        /* Palm/thumb classification per slot */
+    SynapticsGestureTouchRec *gesture_touch;    /* Per-slot state for gesture detection */
+
+    SynapticsParameters synpara;        /* Default parameter settings, read from
+                                           the X config file */
+
+    /* Precomputed tables, the small members first */
+    struct {
+        double step_inv;        /* Table entries per velocity unit */
+        double tail;            /* Slope of the profile beyond the table */
+        double table[ACCEL_TABLE_SIZE]; /* Speed factor at evenly spaced velocities */
+    } accel;
+
+    struct {
+        int seen[4];            /* Extents observed while learning */
+        int band[4 * CALIB_GRID_SIZE];  /* Observed x extents per grid row,
+                                           y extents per grid column */
+        Bool dirty;             /* Learned values not published yet */
+        OsTimerPtr timer;       /* Publishes learned values in the main thread */
+    } learn;                    /* Calibration learning */
+
+    struct {
+        int axis;               /* Pressure valuator, or -1 if not exported */
+        int width_axis;         /* Contact size valuator, or -1 */
+        Bool down;              /* Last posted pressure was not zero */
+        int table[PRESSURE_TABLE_SIZE]; /* Valuator value at evenly spaced pressures */
+    } pressure;
 
+    /* Setup and device access, not used per frame */
+    struct SynapticsProtocolOperations *proto_ops;
+    void *proto_data;           /* protocol-specific data */
+    const char *device;         /* device node */
+    char *record_file;          /* Log file for raw input recording */
+    char *replay_file;          /* Log file to replay instead of the device */
+    OsTimerPtr replay_timer;    /* Feeds the replayed input when it is due */
     enum TouchpadModel model;   /* The detected model */
     unsigned short id_vendor;   /* vendor id */
     unsigned short id_product;  /* product id */
-
-    int scroll_axis_horiz;      /* Horizontal smooth-scrolling axis */
-    int scroll_axis_vert;       /* Vertical smooth-scrolling axis */
-    ValuatorMask *scroll_events_mask;   /* ValuatorMask for smooth-scrolling */
-
-    Bool has_touch;             /* Device has multitouch capabilities */
     int max_touches;            /* Number of touches supported */
     int num_mt_axes;            /* Number of multitouch axes other than X, Y */
     SynapticsTouchAxisRec *touch_axes;  /* Touch axis information other than X, Y */
-    int num_slots;              /* Number of touch slots allocated */
-    int *open_slots;            /* Array of currently open touch slots */
-    int num_active_touches;     /* Number of active touches on device */
 };
 
 #endif                          /* _SYNAPTICSSTR_H_ */
@@ -23,6 +23,24 @@
 
 #include "synproto.h"
 #include "synapticsstr.h"
+#include <time.h>
+
+static void
+HwStateFreeTouchArrays(struct SynapticsHwState *hw)
+{
+    free(hw->touch_id);
+    free(hw->touch_x);
+    free(hw->touch_y);
+    free(hw->touch_major);
+    free(hw->touch_minor);
+    free(hw->touch_pressure);
+    hw->touch_id = NULL;
+    hw->touch_x = NULL;
+    hw->touch_y = NULL;
+    hw->touch_major = NULL;
+    hw->touch_minor = NULL;
+    hw->touch_pressure = NULL;
+}
 
 static int
 HwStateAllocTouch(struct SynapticsHwState *hw, SynapticsPrivate * priv)
@@ -49,9 +67,24 @@ HwStateAllocTouch(struct SynapticsHwState *hw, SynapticsPrivate * priv)
     if (!hw->slot_state)
         goto fail;
 
+    /* Touch positions are also kept as plain int arrays so the multi-finger
+     * geometry code can walk them without going through the masks. */
+    hw->touch_id = calloc(hw->num_mt_mask, sizeof(int));
+    hw->touch_x = calloc(hw->num_mt_mask, sizeof(int));
+    hw->touch_y = calloc(hw->num_mt_mask, sizeof(int));
+    hw->touch_major = calloc(hw->num_mt_mask, sizeof(int));
+    hw->touch_minor = calloc(hw->num_mt_mask, sizeof(int));
+    hw->touch_pressure = calloc(hw->num_mt_mask, sizeof(int));
+    if (!hw->touch_id || !hw->touch_x || !hw->touch_y || !hw->touch_major ||
+        !hw->touch_minor || !hw->touch_pressure)
+        goto fail;
+
     return Success;
 
  fail:
+    HwStateFreeTouchArrays(hw);
+    free(hw->slot_state);
+    hw->slot_state = NULL;
     for (i--; i >= 0; i--)
         valuator_mask_free(&hw->mt_mask[i]);
     free(hw->mt_mask);
@@ -85,6 +118,7 @@ SynapticsHwStateFree(struct SynapticsHwState **hw)
         return;
 
     free((*hw)->slot_state);
+    HwStateFreeTouchArrays(*hw);
     for (i = 0; i < (*hw)->num_mt_mask; i++)
         valuator_mask_free(&(*hw)->mt_mask[i]);
     free((*hw)->mt_mask);
@@ -99,14 +133,14 @@ SynapticsCopyHwState(struct SynapticsHwState *dst,
 {
     int i;
 
+    dst->usec = src->usec;
     dst->millis = src->millis;
     dst->x = src->x;
     dst->y = src->y;
     dst->z = src->z;
-    dst->cumulative_dx = src->cumulative_dx;
-    dst->cumulative_dy = src->cumulative_dy;
     dst->numFingers = src->numFingers;
     dst->fingerWidth = src->fingerWidth;
+    dst->distance = src->distance;
     dst->left = src->left & BTN_EMULATED_FLAG ? 0 : src->left;
     dst->right = src->right & BTN_EMULATED_FLAG ? 0 : src->right;
     dst->up = src->up;
@@ -117,19 +151,27 @@ SynapticsCopyHwState(struct SynapticsHwState *dst,
         valuator_mask_copy(dst->mt_mask[i], src->mt_mask[i]);
     memcpy(dst->slot_state, src->slot_state,
            dst->num_mt_mask * sizeof(enum SynapticsSlotState));
+    dst->num_opened = src->num_opened;
+    memcpy(dst->touch_id, src->touch_id, dst->num_mt_mask * sizeof(int));
+    memcpy(dst->touch_x, src->touch_x, dst->num_mt_mask * sizeof(int));
+    memcpy(dst->touch_y, src->touch_y, dst->num_mt_mask * sizeof(int));
+    memcpy(dst->touch_major, src->touch_major, dst->num_mt_mask * sizeof(int));
+    memcpy(dst->touch_minor, src->touch_minor, dst->num_mt_mask * sizeof(int));
+    memcpy(dst->touch_pressure, src->touch_pressure,
+           dst->num_mt_mask * sizeof(int));
 }
 
 void
 SynapticsResetHwState(struct SynapticsHwState *hw)
 {
+    hw->usec = 0;
     hw->millis = 0;
     hw->x = INT_MIN;
     hw->y = INT_MIN;
     hw->z = 0;
-    hw->cumulative_dx = 0;
-    hw->cumulative_dy = 0;
     hw->numFingers = 0;
     hw->fingerWidth = 0;
+    hw->distance = 0;
 
     hw->left = 0;
     hw->right = 0;
@@ -147,6 +189,8 @@ SynapticsResetTouchHwState(struct SynapticsHwState *hw, Bool set_slot_empty)
 {
     int i;
 
+    hw->num_opened = 0;
+
     for (i = 0; i < hw->num_mt_mask; i++) {
         int j;
 
@@ -168,3 +212,18 @@ SynapticsResetTouchHwState(struct SynapticsHwState *hw, Bool set_slot_empty)
         }
     }
 }
+
+/*
+ * Monotonic time in microseconds, the same clock the server's
+ * GetTimeInMillis() and the kernel's evdev timestamps use.
+ */
+CARD64
+SynapticsGetTimeInMicros(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return (CARD64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+    return (CARD64) GetTimeInMillis() * 1000;
+}
@@ -60,14 +60,14 @@ enum SynapticsSlotState {
  * A structure to describe the state of the touchpad hardware (buttons and pad)
  */
 struct SynapticsHwState {
-    CARD32 millis;              /* Timestamp in milliseconds */
+    CARD64 usec;                /* Timestamp in microseconds */
+    CARD32 millis;              /* The same in milliseconds, for timeouts */
     int x;                      /* X position of finger */
     int y;                      /* Y position of finger */
     int z;                      /* Finger pressure */
-    int cumulative_dx;          /* Cumulative delta X for clickpad dragging */
-    int cumulative_dy;          /* Cumulative delta Y for clickpad dragging */
     int numFingers;
     int fingerWidth;
+    int distance;               /* Hover distance above the pad, 0 on contact */
 
     Bool left;
     Bool right;
@@ -80,8 +80,21 @@ struct SynapticsHwState {
     int num_mt_mask;
     ValuatorMask **mt_mask;
     enum SynapticsSlotState *slot_state;
+    int num_opened;             /* Slots set to SLOTSTATE_OPEN in this frame */
+    int *touch_id;              /* Per-slot ABS_MT_TRACKING_ID */
+    int *touch_x;               /* Per-slot X position, same as mt_mask axis 0 */
+    int *touch_y;               /* Per-slot Y position, same as mt_mask axis 1 */
+    int *touch_major;           /* Per-slot ABS_MT_TOUCH_MAJOR */
+    int *touch_minor;           /* Per-slot ABS_MT_TOUCH_MINOR */
+    int *touch_pressure;        /* Per-slot ABS_MT_PRESSURE */
 };
 
+struct SynapticsRecorder;
+struct SynapticsReplay;
+
+#define COMM_RING_SIZE 256      /* Must be a power of two */
+#define COMM_RING_BYTE(comm, i) ((comm)->ring[(i) & (COMM_RING_SIZE - 1)])
+
 struct CommData {
     XISBuffer *buffer;
     unsigned char protoBuf[6];  /* Buffer for Packet */
@@ -89,6 +102,12 @@ struct CommData {
     int outOfSync;              /* How many consecutive incorrect packets we
                                    have received */
     int protoBufTail;
+    unsigned char ring[COMM_RING_SIZE]; /* Bytes read but not framed yet */
+    unsigned int ringHead;      /* Next byte to frame, free running */
+    unsigned int ringTail;      /* Next byte to fill, free running */
+    int resyncBytes;            /* Bytes dropped to regain sync in the last read */
+    struct SynapticsRecorder *recorder; /* Raw input is logged here if set */
+    struct SynapticsReplay *replay;     /* Input comes from here if set */
 
     /* Used for keeping track of partial HwState updates. */
     struct SynapticsHwState *hwState;
@@ -109,6 +128,9 @@ struct SynapticsProtocolOperations {
                          struct SynapticsHwState * hwRet);
     Bool (*AutoDevProbe) (InputInfoPtr pInfo, const char *device);
     void (*ReadDevDimensions) (InputInfoPtr pInfo);
+    Bool (*SetReportRate) (InputInfoPtr pInfo, Bool high);
+    Bool adaptive_rate;         /* Rate switches are cheap enough to follow
+                                   the finger */
 };
 
 #ifdef BUILD_PS2COMM
@@ -130,6 +152,57 @@ extern void SynapticsResetHwState(struct SynapticsHwState *hw);
 extern void SynapticsResetTouchHwState(struct SynapticsHwState *hw,
                                        Bool set_slot_empty);
 
+extern CARD64 SynapticsGetTimeInMicros(void);
+
 extern Bool SynapticsIsSoftButtonAreasValid(int *values);
+extern void SynapticsSelectHandleState(SynapticsPrivate * priv);
+extern void SynapticsResyncState(SynapticsPrivate * priv);
+extern Bool SynapticsIsAccelPointsValid(const float *points, int num_points);
+extern void SynapticsUpdateAccelProfile(SynapticsPrivate * priv);
+extern Bool SynapticsIsPressureCurveValid(const int *curve);
+extern void SynapticsUpdatePressureCurve(SynapticsPrivate * priv);
+extern Bool SynapticsIsCalibrationValid(const int *extents);
+extern void SynapticsUpdateCalibration(SynapticsPrivate * priv);
+extern void SynapticsResetCalibrationLearning(SynapticsPrivate * priv);
+
+extern Bool SynapticsSetRecording(InputInfoPtr pInfo, Bool on);
+extern void SynapticsRecordByte(struct SynapticsRecorder *rec,
+                                unsigned char b);
+extern void SynapticsRecordEvent(struct SynapticsRecorder *rec,
+                                 const struct timeval *time,
+                                 int type, int code, int value);
+extern struct SynapticsReplay *SynapticsReplayOpen(const char *path);
+extern void SynapticsReplayFree(struct SynapticsReplay *replay);
+extern int SynapticsReplayByte(struct CommData *comm);
+extern Bool SynapticsReplayEvent(struct SynapticsReplay *replay,
+                                 struct timeval *time,
+                                 int *type, int *code, int *value);
+extern int SynapticsReplayDelay(struct SynapticsReplay *replay);
+
+/* Set the timestamp of a hardware state */
+static inline void
+SynapticsSetHwTime(struct SynapticsHwState *hw, CARD64 usec)
+{
+    hw->usec = usec;
+    hw->millis = usec / 1000;
+}
+
+/*
+ * Read the next raw byte from the device, or from the log being replayed.
+ * Returns -1 if there is none.
+ */
+static inline int
+SynapticsCommRead(struct CommData *comm)
+{
+    int c;
+
+    if (comm->replay)
+        return SynapticsReplayByte(comm);
+
+    c = XisbRead(comm->buffer);
+    if (c >= 0 && comm->recorder)
+        SynapticsRecordByte(comm->recorder, c);
+    return c;
+}
 
 #endif                          /* _SYNPROTO_H_ */
@@ -99,6 +99,7 @@ static struct Parameter params[] = {
     {"MinSpeed",              PT_DOUBLE, 0, 255.0,   SYNAPTICS_PROP_SPEED,	0, /*float */	0},
     {"MaxSpeed",              PT_DOUBLE, 0, 255.0,   SYNAPTICS_PROP_SPEED,	0, /*float */	1},
     {"AccelFactor",           PT_DOUBLE, 0, 1.0,   SYNAPTICS_PROP_SPEED,	0, /*float */	2},
+    {"AccelProfile",          PT_INT,    0, 2,     SYNAPTICS_PROP_ACCEL_PROFILE,	8,	0},
     {"UpDownScrolling",       PT_BOOL,   0, 1,     SYNAPTICS_PROP_BUTTONSCROLLING,  8,	0},
     {"LeftRightScrolling",    PT_BOOL,   0, 1,     SYNAPTICS_PROP_BUTTONSCROLLING,  8,	1},
     {"UpDownScrollRepeat",    PT_BOOL,   0, 1,     SYNAPTICS_PROP_BUTTONSCROLLING_REPEAT,   8,	0},
@@ -122,6 +123,7 @@ static struct Parameter params[] = {
     {"CircScrollTrigger",     PT_INT,    0, 8,     SYNAPTICS_PROP_CIRCULAR_SCROLLING_TRIGGER,	8,	0},
     {"CircularPad",           PT_BOOL,   0, 1,     SYNAPTICS_PROP_CIRCULAR_PAD,	8,	0},
     {"PalmDetect",            PT_BOOL,   0, 1,     SYNAPTICS_PROP_PALM_DETECT,	8,	0},
+    {"AbsoluteHover",         PT_BOOL,   0, 1,     SYNAPTICS_PROP_ABSOLUTE_HOVER,	8,	0},
     {"PalmMinWidth",          PT_INT,    0, 15,    SYNAPTICS_PROP_PALM_DIMENSIONS,	32,	0},
     {"PalmMinZ",              PT_INT,    0, 255,   SYNAPTICS_PROP_PALM_DIMENSIONS,	32,	1},
     {"CoastingSpeed",         PT_DOUBLE, 0, 255,    SYNAPTICS_PROP_COASTING_SPEED,	0 /* float*/,	0},
@@ -136,9 +138,40 @@ static struct Parameter params[] = {
     {"AreaRightEdge",         PT_INT,    0, 10000, SYNAPTICS_PROP_AREA,	32,	1},
     {"AreaTopEdge",           PT_INT,    0, 10000, SYNAPTICS_PROP_AREA,	32,	2},
     {"AreaBottomEdge",        PT_INT,    0, 10000, SYNAPTICS_PROP_AREA,	32,	3},
+    {"AbsoluteZoneLeftEdge",  PT_INT,    0, 10000, SYNAPTICS_PROP_ABSOLUTE_ZONE,	32,	0},
+    {"AbsoluteZoneRightEdge", PT_INT,    0, 10000, SYNAPTICS_PROP_ABSOLUTE_ZONE,	32,	1},
+    {"AbsoluteZoneTopEdge",   PT_INT,    0, 10000, SYNAPTICS_PROP_ABSOLUTE_ZONE,	32,	2},
+    {"AbsoluteZoneBottomEdge", PT_INT,   0, 10000, SYNAPTICS_PROP_ABSOLUTE_ZONE,	32,	3},
     {"HorizHysteresis",       PT_INT,    0, 10000, SYNAPTICS_PROP_NOISE_CANCELLATION, 32,	0},
     {"VertHysteresis",        PT_INT,    0, 10000, SYNAPTICS_PROP_NOISE_CANCELLATION, 32,	1},
     {"ClickPad",              PT_BOOL,   0, 1,     SYNAPTICS_PROP_CLICKPAD,	8,	0},
+    {"Record",                PT_BOOL,   0, 1,     SYNAPTICS_PROP_RECORD,	8,	0},
+    {"ThreeFingerSwipeLeft",  PT_INT,   -4, SYN_MAX_BUTTONS, SYNAPTICS_PROP_GESTURE_ACTIONS,	32,	0},
+    {"ThreeFingerSwipeRight", PT_INT,   -4, SYN_MAX_BUTTONS, SYNAPTICS_PROP_GESTURE_ACTIONS,	32,	1},
+    {"ThreeFingerSwipeUp",    PT_INT,   -4, SYN_MAX_BUTTONS, SYNAPTICS_PROP_GESTURE_ACTIONS,	32,	2},
+    {"ThreeFingerSwipeDown",  PT_INT,   -4, SYN_MAX_BUTTONS, SYNAPTICS_PROP_GESTURE_ACTIONS,	32,	3},
+    {"FourFingerSwipeLeft",   PT_INT,   -4, SYN_MAX_BUTTONS, SYNAPTICS_PROP_GESTURE_ACTIONS,	32,	4},
+    {"FourFingerSwipeRight",  PT_INT,   -4, SYN_MAX_BUTTONS, SYNAPTICS_PROP_GESTURE_ACTIONS,	32,	5},
+    {"FourFingerSwipeUp",     PT_INT,   -4, SYN_MAX_BUTTONS, SYNAPTICS_PROP_GESTURE_ACTIONS,	32,	6},
+    {"FourFingerSwipeDown",   PT_INT,   -4, SYN_MAX_BUTTONS, SYNAPTICS_PROP_GESTURE_ACTIONS,	32,	7},
+    {"PinchIn",               PT_INT,   -4, SYN_MAX_BUTTONS, SYNAPTICS_PROP_GESTURE_ACTIONS,	32,	8},
+    {"PinchOut",              PT_INT,   -4, SYN_MAX_BUTTONS, SYNAPTICS_PROP_GESTURE_ACTIONS,	32,	9},
+    {"RotateLeft",            PT_INT,   -4, SYN_MAX_BUTTONS, SYNAPTICS_PROP_GESTURE_ACTIONS,	32,	10},
+    {"RotateRight",           PT_INT,   -4, SYN_MAX_BUTTONS, SYNAPTICS_PROP_GESTURE_ACTIONS,	32,	11},
+    {"SwipeDistance",         PT_INT,    0, 10000, SYNAPTICS_PROP_GESTURE_THRESHOLDS,	32,	0},
+    {"PinchRatio",            PT_INT,    0, 1000, SYNAPTICS_PROP_GESTURE_THRESHOLDS,	32,	1},
+    {"RotateAngle",           PT_INT,    0, 180, SYNAPTICS_PROP_GESTURE_THRESHOLDS,	32,	2},
+    {"PressureCurveX1",       PT_INT,    0, 100,   SYNAPTICS_PROP_PRESSURE_CURVE,	32,	0},
+    {"PressureCurveY1",       PT_INT,    0, 100,   SYNAPTICS_PROP_PRESSURE_CURVE,	32,	1},
+    {"PressureCurveX2",       PT_INT,    0, 100,   SYNAPTICS_PROP_PRESSURE_CURVE,	32,	2},
+    {"PressureCurveY2",       PT_INT,    0, 100,   SYNAPTICS_PROP_PRESSURE_CURVE,	32,	3},
+    {"CalibrationLearning",   PT_BOOL,   0, 1,     SYNAPTICS_PROP_CALIBRATION_LEARNING,	8,	0},
+    {"CalibrationGrid",       PT_BOOL,   0, 1,     SYNAPTICS_PROP_CALIBRATION_LEARNING,	8,	1},
+    {"CalibrationMinX",       PT_INT, INT_MIN, INT_MAX, SYNAPTICS_PROP_CALIBRATION,	32,	0},
+    {"CalibrationMaxX",       PT_INT, INT_MIN, INT_MAX, SYNAPTICS_PROP_CALIBRATION,	32,	1},
+    {"CalibrationMinY",       PT_INT, INT_MIN, INT_MAX, SYNAPTICS_PROP_CALIBRATION,	32,	2},
+    {"CalibrationMaxY",       PT_INT, INT_MIN, INT_MAX, SYNAPTICS_PROP_CALIBRATION,	32,	3},
+    {"ReportRate",            PT_INT,    0, 2,     SYNAPTICS_PROP_REPORT_RATE,	8,	0},
     {"RightButtonAreaLeft",   PT_INT, INT_MIN, INT_MAX, SYNAPTICS_PROP_SOFTBUTTON_AREAS,	32,	0},
     {"RightButtonAreaRight",  PT_INT, INT_MIN, INT_MAX, SYNAPTICS_PROP_SOFTBUTTON_AREAS,	32,	1},
     {"RightButtonAreaTop",    PT_INT, INT_MIN, INT_MAX, SYNAPTICS_PROP_SOFTBUTTON_AREAS,	32,	2},